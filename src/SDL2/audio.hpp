@@ -1,29 +1,75 @@
 #ifndef GBX_AUDIO_HPP_
 #define GBX_AUDIO_HPP_
 #include <stdint.h>
+#include <string.h>
+#include <atomic>
 #include "SDL.h"
 #include "SDL_audio.h"
 
 
-constexpr const auto kAudioMaxVolume = SDL_MIX_MAXVOLUME;
+constexpr const uint32_t kAudioRingSize = 8192;
 
+static_assert((kAudioRingSize & (kAudioRingSize - 1)) == 0,
+              "kAudioRingSize must be a power of 2");
 
-inline void mix_audio(int16_t* const dest, const int16_t src, const int volume)
+
+// lock-free single producer ( the emulation thread ) single consumer
+// ( the SDL audio callback ) ring of samples. 'head' and 'tail' only
+// ever grow, each side owns one of them and reads the other.
+// overruns count the buffers the producer couldn't fit entirely,
+// underruns the callbacks the consumer couldn't fill entirely.
+struct AudioRing {
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	std::atomic<uint32_t> overruns;
+	std::atomic<uint32_t> underruns;
+	int16_t samples[kAudioRingSize];
+};
+
+
+inline void write_audio_ring(const int16_t* const src, const uint32_t count, AudioRing* const ring)
 {
-	*dest += src;
-	*dest = (*dest * volume) / kAudioMaxVolume;
+	const uint32_t head = ring->head.load(std::memory_order_relaxed);
+	const uint32_t tail = ring->tail.load(std::memory_order_acquire);
+	const uint32_t space = kAudioRingSize - (head - tail);
+
+	uint32_t n = count;
+	if (n > space) {
+		n = space;
+		ring->overruns.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	for (uint32_t i = 0; i < n; ++i)
+		ring->samples[(head + i) & (kAudioRingSize - 1)] = src[i];
+
+	ring->head.store(head + n, std::memory_order_release);
 }
 
 
-inline void queue_sound_buffer(const int16_t* const buffer, const uint_fast32_t len)
+inline void read_audio_ring(int16_t* const dest, const uint32_t count, AudioRing* const ring)
 {
-	extern SDL_AudioDeviceID audio_device;
+	const uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+	const uint32_t head = ring->head.load(std::memory_order_acquire);
+	const uint32_t available = head - tail;
 
-	while (SDL_GetQueuedAudioSize(audio_device) > len)
-		SDL_Delay(1);
+	uint32_t n = count;
+	if (n > available) {
+		n = available;
+		memset(&dest[n], 0, sizeof(int16_t) * (count - n));
+		ring->underruns.fetch_add(1, std::memory_order_relaxed);
+	}
 
-	if (SDL_QueueAudio(audio_device, (const uint8_t*)buffer, len) != 0)
-		fprintf(stderr, "Failed to queue audio: %s\n", SDL_GetError());
+	for (uint32_t i = 0; i < n; ++i)
+		dest[i] = ring->samples[(tail + i) & (kAudioRingSize - 1)];
+
+	ring->tail.store(tail + n, std::memory_order_release);
+}
+
+
+// the gameboy's audio sink, 'userdata' is the ring
+inline void queue_sound_buffer(const int16_t* const samples, const int32_t count, void* const userdata)
+{
+	write_audio_ring(samples, count, static_cast<AudioRing*>(userdata));
 }
 
 
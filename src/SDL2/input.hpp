@@ -3,7 +3,9 @@
 #include "gameboy.hpp"
 
 
-extern bool process_inputs(gbx::Gameboy* gbx); // returns false if user ends application
+// the gameboy keys go to 'pad', 'rewinding' is set while backspace
+// is held. returns false if user ends application
+extern bool process_inputs(gbx::Joypad* pad, bool* rewinding);
 
 
 #endif
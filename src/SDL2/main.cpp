@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
 #include "SDL.h"
 #include "SDL_audio.h"
 #include "input.hpp"
@@ -8,12 +9,32 @@
 #include "audio.hpp"
 
 
+// what the emulation thread shares with the main thread: the keys
+// held, read before each frame, whether the rewind key is held
+// and whether to keep running
+struct Session {
+	gbx::Gameboy* gb;
+	gbx::Gameboy* ref;
+	gbx::Rewind* rewind;
+	gbx::RunAhead* ahead;
+	std::atomic<uint8_t> keys;
+	std::atomic<bool> rewinding;
+	std::atomic<bool> running;
+	bool match;
+};
+
+
 static bool init_sdl();
 static void quit_sdl();
+static int run_emulation(void* data);
+static void audio_callback(void* userdata, uint8_t* stream, int len);
+static void wait_next_frame();
 
 
 constexpr const int kWinWidth = 160;
 constexpr const int kWinHeight = 144;
+constexpr const int32_t kFrameCycles = 70224;
+constexpr const uint32_t kRewindSeconds = 10;
 
 static SDL_Event events;
 static SDL_Window* window = nullptr;
@@ -21,33 +42,198 @@ static SDL_Window* window = nullptr;
 SDL_Texture* texture = nullptr;
 SDL_Renderer* renderer = nullptr;
 SDL_AudioDeviceID audio_device = 0;
+AudioRing audio_ring;
+gbx::FrameRing frame_ring;
 
 
 int main(int argc, char** argv)
 {
 	if (argc < 2) {
-		fprintf(stderr, "Usage: %s [rom]\n", argv[0]);
+		fprintf(stderr, "Usage: %s [--jit | --jit-verify] [--no-idle-skip] "
+		                "[--fifo-ppu] [--async-ppu] [--run-ahead N] [rom]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char* const rom_path = argv[argc - 1];
+	bool jit = false;
+	bool jit_verify = false;
+	bool idle_skip = true;
+	bool fifo_ppu = false;
+	bool async_ppu = false;
+	int run_ahead = 0;
+	for (int i = 1; i < argc - 1; ++i) {
+		if (strcmp(argv[i], "--jit") == 0) {
+			jit = true;
+		} else if (strcmp(argv[i], "--jit-verify") == 0) {
+			jit_verify = true;
+		} else if (strcmp(argv[i], "--no-idle-skip") == 0) {
+			idle_skip = false;
+		} else if (strcmp(argv[i], "--fifo-ppu") == 0) {
+			fifo_ppu = true;
+		} else if (strcmp(argv[i], "--async-ppu") == 0) {
+			async_ppu = true;
+		} else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc - 1) {
+			run_ahead = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (run_ahead < 0 || run_ahead > 8) {
+		fprintf(stderr, "invalid run-ahead frames: %d\n", run_ahead);
 		return EXIT_FAILURE;
 	}
 
-	gbx::Gameboy* const gb = gbx::create_gameboy(argv[1]);
+	gbx::Gameboy* const gb = gbx::create_gameboy(rom_path);
 
 	if (gb == nullptr)
 		return EXIT_FAILURE;
 
+	const auto gb_guard = gbx::finally([gb] {
+		gbx::destroy_gameboy(gb);
+	});
+
+	if ((jit || jit_verify) && !gbx::set_cpu_backend(gbx::CpuBackend::Jit, gb))
+		return EXIT_FAILURE;
+
+	gb->idle.enabled = idle_skip;
+	if (fifo_ppu)
+		gbx::set_ppu_accuracy(gbx::PpuAccuracy::Fifo, gb);
+	if (async_ppu && !gbx::set_ppu_async(true, gb))
+		return EXIT_FAILURE;
+	gbx::init_frame_ring(&frame_ring);
+	gb->sinks.frame = queue_frame;
+	gb->sinks.audio = queue_sound_buffer;
+	gb->sinks.userdata = &audio_ring;
+
+	// --jit-verify runs a second gameboy on the interpreter
+	// and compares both after every frame, its output is discarded
+	gbx::Gameboy* const ref = jit_verify ? gbx::create_gameboy(rom_path) : nullptr;
+
+	if (jit_verify && ref == nullptr)
+		return EXIT_FAILURE;
+
+	const auto ref_guard = gbx::finally([ref] {
+		if (ref != nullptr)
+			gbx::destroy_gameboy(ref);
+	});
+
+	if (ref != nullptr) {
+		ref->idle.enabled = idle_skip;
+		if (fifo_ppu)
+			gbx::set_ppu_accuracy(gbx::PpuAccuracy::Fifo, ref);
+		gbx::set_render_policy({ gbx::RenderMode::Never, 0 }, &ref->ppu);
+	}
+
+	// the rewind would take the two gameboys out of step
+	gbx::Rewind* const rewind = ref != nullptr ? nullptr
+	  : gbx::create_rewind(kRewindSeconds * 60, kRewindSeconds * gbx::kRewindBytesPerSecond, *gb);
+
+	if (ref == nullptr && rewind == nullptr)
+		return EXIT_FAILURE;
+
+	const auto rewind_guard = gbx::finally([rewind] {
+		if (rewind != nullptr)
+			gbx::destroy_rewind(rewind);
+	});
+
+	// each frame shown is 'run_ahead' frames past the state the
+	// next input goes to, hiding as many frames of the game's lag
+	gbx::RunAhead* const ahead = gbx::create_run_ahead(static_cast<uint8_t>(run_ahead), *gb);
+
+	if (ahead == nullptr)
+		return EXIT_FAILURE;
+
+	const auto ahead_guard = gbx::finally([ahead] {
+		gbx::destroy_run_ahead(ahead);
+	});
+
 	if (!init_sdl())
 		return EXIT_FAILURE;
 
-	while (process_inputs(gb))
-		gbx::run_for(70224, gb);
+	// the emulation runs on its own thread, so presenting and waiting
+	// for vsync here never hold it back. frames it made while the
+	// last one was presented are dropped, only the newest is shown
+	Session session;
+	session.gb = gb;
+	session.ref = ref;
+	session.rewind = rewind;
+	session.ahead = ahead;
+	session.keys.store(gb->joypad.keys.both);
+	session.rewinding.store(false);
+	session.running.store(true);
+	session.match = true;
+
+	SDL_Thread* const thread = SDL_CreateThread(run_emulation, "emulation", &session);
+	if (thread == nullptr) {
+		fprintf(stderr, "failed to create emulation thread: %s\n", SDL_GetError());
+		quit_sdl();
+		return EXIT_FAILURE;
+	}
+
+	gbx::Joypad pad = gb->joypad;
+	bool rewinding = false;
+	while (session.running.load(std::memory_order_relaxed) && process_inputs(&pad, &rewinding)) {
+		session.keys.store(pad.keys.both, std::memory_order_relaxed);
+		session.rewinding.store(rewinding, std::memory_order_relaxed);
+		if (!render_graphics())
+			SDL_Delay(1);
+	}
+
+	session.running.store(false);
+	SDL_WaitThread(thread, nullptr);
 
 	quit_sdl();
-	gbx::destroy_gameboy(gb);
-	return EXIT_SUCCESS;
+	printf("AUDIO UNDERRUNS: %u\n"
+	       "AUDIO OVERRUNS: %u\n"
+	       "FRAMES DROPPED: %u\n",
+	       audio_ring.underruns.load(), audio_ring.overruns.load(),
+	       frame_ring.dropped.load());
+	gbx::print_idle_loops(gb->idle);
+	return session.match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int run_emulation(void* const data)
+{
+	Session* const session = static_cast<Session*>(data);
+	gbx::Gameboy* const gb = session->gb;
+	gbx::Gameboy* const ref = session->ref;
+	gbx::Rewind* const rewind = session->rewind;
+	gbx::RunAhead* const ahead = session->ahead;
+
+	while (session->running.load(std::memory_order_relaxed)) {
+		// while rewinding, each frame steps back to the state
+		// captured a frame earlier and shows how far it had drawn
+		if (rewind != nullptr && session->rewinding.load(std::memory_order_relaxed)) {
+			if (gbx::rewind_frame(gb, rewind))
+				queue_frame(gbx::get_ppu_screen(gb), nullptr);
+			wait_next_frame();
+			continue;
+		}
+
+		gbx::set_joypad_keys(session->keys.load(std::memory_order_relaxed),
+		                     &gb->hwstate, &gb->joypad);
+		gbx::run_ahead_for(kFrameCycles, ahead, gb);
+		if (rewind != nullptr)
+			gbx::capture_rewind(gb, rewind);
+		if (ref != nullptr) {
+			gbx::set_joypad_keys(gb->joypad.keys.both, &ref->hwstate, &ref->joypad);
+			gbx::run_for(kFrameCycles, ref);
+			if (!gbx::cross_check(*gb, *ref)) {
+				session->match = false;
+				session->running.store(false);
+			}
+		}
+		wait_next_frame();
+	}
+
+	return 0;
 }
 
 
-bool process_inputs(gbx::Gameboy* const gb)
+bool process_inputs(gbx::Joypad* const pad, bool* const rewinding)
 {
 	constexpr const uint32_t keycodes[8] {
 		SDL_SCANCODE_Z, SDL_SCANCODE_X, 
@@ -57,15 +243,19 @@ bool process_inputs(gbx::Gameboy* const gb)
 	};
 
 	const auto update_key = [&] (const gbx::KeyState state, const uint32_t keycode) {
-		gbx::update_joypad(keycodes, keycode, state, &gb->hwstate, &gb->joypad);
+		gbx::update_joypad(keycodes, keycode, state, nullptr, pad);
 	};
 
 	while (SDL_PollEvent(&events)) {
 		switch (events.type) {
 		case SDL_KEYDOWN:
+			if (events.key.keysym.scancode == SDL_SCANCODE_BACKSPACE)
+				*rewinding = true;
 			update_key(gbx::KeyState::Down, events.key.keysym.scancode);
 			break;
 		case SDL_KEYUP:
+			if (events.key.keysym.scancode == SDL_SCANCODE_BACKSPACE)
+				*rewinding = false;
 			update_key(gbx::KeyState::Up, events.key.keysym.scancode);
 			break;
 
@@ -99,7 +289,7 @@ bool init_sdl()
 	}
 
 	renderer = SDL_CreateRenderer(window, -1,
-	  SDL_RENDERER_ACCELERATED);
+	  SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
 	if (renderer == nullptr) {
 		fprintf(stderr, "failed to create SDL_Renderer: %s\n",
@@ -125,6 +315,8 @@ bool init_sdl()
 	want.format = AUDIO_S16SYS;
 	want.channels = 1;
 	want.samples = 1024;
+	want.callback = audio_callback;
+	want.userdata = &audio_ring;
 
 	if ((audio_device = SDL_OpenAudioDevice(nullptr, 0, &want, nullptr, 0)) == 0) {
 		fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
@@ -153,9 +345,33 @@ free_sdl:
 
 void quit_sdl()
 {
+	SDL_CloseAudioDevice(audio_device);
 	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
 
+
+void audio_callback(void* const userdata, uint8_t* const stream, const int len)
+{
+	auto* const ring = static_cast<AudioRing*>(userdata);
+	read_audio_ring(reinterpret_cast<int16_t*>(stream), len / sizeof(int16_t), ring);
+}
+
+
+void wait_next_frame()
+{
+	// the audio ring no longer blocks the emulation,
+	// so frames are paced against the performance counter
+	static const uint64_t frequency = SDL_GetPerformanceFrequency();
+	static const uint64_t frame_ticks = (frequency * kFrameCycles) / gbx::kCpuFreq;
+	static uint64_t next_frame = SDL_GetPerformanceCounter();
+
+	next_frame += frame_ticks;
+	const uint64_t now = SDL_GetPerformanceCounter();
+	if (now < next_frame)
+		SDL_Delay(static_cast<uint32_t>(((next_frame - now) * 1000) / frequency));
+	else if (now - next_frame > frame_ticks)
+		next_frame = now;
+}
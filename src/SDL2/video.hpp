@@ -2,17 +2,34 @@
 #define GBX_VIDEO_HPP_
 #include <stdint.h>
 #include "SDL.h"
+#include "frame.hpp"
 
 
-inline void render_graphics(const uint32_t* const pixels, const uint_fast32_t len)
+// the gameboy's frame sink, called from the emulation thread
+// ( or the ppu worker's ), it never waits for the presenter
+inline void queue_frame(const gbx::Frame& frame, void* /*userdata*/)
+{
+	extern gbx::FrameRing frame_ring;
+	gbx::publish_frame(frame, &frame_ring);
+}
+
+
+// presents the last frame queued if there is a new one, from the
+// thread owning the renderer. returns false if there wasn't any
+inline bool render_graphics()
 {
 	extern SDL_Texture* texture;
 	extern SDL_Renderer* renderer;
+	extern gbx::FrameRing frame_ring;
+
+	const gbx::Frame* const frame = gbx::poll_frame(&frame_ring);
+	if (frame == nullptr)
+		return false;
 
 	int pitch;
 	void* dest;
 	if (SDL_LockTexture(texture, nullptr, &dest, &pitch) == 0) {
-		memcpy(dest, pixels, len);
+		gbx::convert_frame(*frame, gbx::PixelFormat::Argb8888, dest);
 		SDL_UnlockTexture(texture);
 		SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 		SDL_RenderPresent(renderer);
@@ -20,6 +37,8 @@ inline void render_graphics(const uint32_t* const pixels, const uint_fast32_t le
 		const char* const err = SDL_GetError();
 		fprintf(stderr, "failed to lock texture: %s\n", err);
 	}
+
+	return true;
 }
 
 
@@ -1,21 +1,128 @@
 #include <climits>
-#include "audio.hpp"
 #include "apu.hpp"
 
 
 namespace gbx {
 
-constexpr const int kApuSamplesSize = 95;
-constexpr const int kSoundBufferSize = 1024;
+// host samples per cycle in 32.32 fixed point
+constexpr const uint64_t kBlipFactor = (static_cast<uint64_t>(kApuSampleRate) << 32) / kCpuFreq;
+constexpr const int kBlipDeltaBits = 15;
+constexpr const int kBlipBassShift = 9;
+constexpr const int32_t kAmpScale = 16;
+
+// windowed sinc steps, each phase sums to 1 << kBlipDeltaBits
+static const int16_t kBlipKernel[kApuBlipPhases][kApuBlipTaps] = {
+	{     18,   -110,    359,   -843,   1561,  -2371,   3025,  29490,   3025,  -2371,   1561,   -843,    359,   -110,     18,      0 },
+	{     17,   -108,    347,   -795,   1421,  -2025,   2117,  29452,   3974,  -2714,   1693,   -887,    369,   -111,     18,      0 },
+	{     17,   -105,    332,   -742,   1276,  -1679,   1252,  29332,   4960,  -3051,   1818,   -925,    376,   -110,     17,      0 },
+	{     16,   -102,    315,   -686,   1128,  -1335,    434,  29131,   5981,  -3378,   1932,   -956,    380,   -109,     17,      0 },
+	{     16,    -98,    297,   -627,    977,   -997,   -336,  28853,   7031,  -3693,   2036,   -982,    381,   -106,     16,      0 },
+	{     15,    -93,    277,   -566,    824,   -665,  -1055,  28499,   8106,  -3992,   2127,   -999,    378,   -103,     15,      0 },
+	{     14,    -87,    256,   -503,    672,   -343,  -1721,  28067,   9203,  -4273,   2204,  -1009,    372,    -97,     13,      0 },
+	{     13,    -82,    234,   -439,    522,    -34,  -2334,  27565,  10317,  -4531,   2266,  -1011,    362,    -91,     11,      0 },
+	{     12,    -76,    211,   -375,    374,    262,  -2891,  26992,  11444,  -4765,   2311,  -1004,    348,    -83,      8,      0 },
+	{     10,    -69,    188,   -311,    229,    543,  -3394,  26350,  12577,  -4970,   2339,   -987,    330,    -73,      6,      0 },
+	{      9,    -63,    165,   -248,     90,    807,  -3840,  25646,  13712,  -5144,   2348,   -962,    308,    -62,      2,      0 },
+	{      8,    -56,    142,   -186,    -44,   1052,  -4231,  24877,  14845,  -5283,   2338,   -926,    282,    -50,     -1,      1 },
+	{      7,    -50,    119,   -126,   -171,   1277,  -4566,  24057,  15970,  -5386,   2307,   -881,    251,    -36,     -5,      1 },
+	{      6,    -44,     96,    -68,   -291,   1482,  -4846,  23182,  17081,  -5448,   2255,   -825,    217,    -21,    -10,      2 },
+	{      5,    -37,     74,    -12,   -403,   1666,  -5072,  22257,  18174,  -5467,   2182,   -760,    178,     -4,    -15,      2 },
+	{      4,    -31,     53,     41,   -506,   1828,  -5246,  21289,  19243,  -5441,   2086,   -685,    136,     14,    -20,      3 },
+	{      3,    -25,     33,     90,   -600,   1968,  -5368,  20283,  20283,  -5368,   1968,   -600,     90,     33,    -25,      3 },
+	{      3,    -20,     14,    136,   -685,   2086,  -5441,  19243,  21289,  -5246,   1828,   -506,     41,     53,    -31,      4 },
+	{      2,    -15,     -4,    178,   -760,   2182,  -5467,  18174,  22257,  -5072,   1666,   -403,    -12,     74,    -37,      5 },
+	{      2,    -10,    -21,    217,   -825,   2255,  -5448,  17081,  23182,  -4846,   1482,   -291,    -68,     96,    -44,      6 },
+	{      1,     -5,    -36,    251,   -881,   2307,  -5386,  15970,  24057,  -4566,   1277,   -171,   -126,    119,    -50,      7 },
+	{      1,     -1,    -50,    282,   -926,   2338,  -5283,  14845,  24877,  -4231,   1052,    -44,   -186,    142,    -56,      8 },
+	{      0,      2,    -62,    308,   -962,   2348,  -5144,  13712,  25646,  -3840,    807,     90,   -248,    165,    -63,      9 },
+	{      0,      6,    -73,    330,   -987,   2339,  -4970,  12577,  26350,  -3394,    543,    229,   -311,    188,    -69,     10 },
+	{      0,      8,    -83,    348,  -1004,   2311,  -4765,  11444,  26992,  -2891,    262,    374,   -375,    211,    -76,     12 },
+	{      0,     11,    -91,    362,  -1011,   2266,  -4531,  10317,  27565,  -2334,    -34,    522,   -439,    234,    -82,     13 },
+	{      0,     13,    -97,    372,  -1009,   2204,  -4273,   9203,  28067,  -1721,   -343,    672,   -503,    256,    -87,     14 },
+	{      0,     15,   -103,    378,   -999,   2127,  -3992,   8106,  28499,  -1055,   -665,    824,   -566,    277,    -93,     15 },
+	{      0,     16,   -106,    381,   -982,   2036,  -3693,   7031,  28853,   -336,   -997,    977,   -627,    297,    -98,     16 },
+	{      0,     17,   -109,    380,   -956,   1932,  -3378,   5981,  29131,    434,  -1335,   1128,   -686,    315,   -102,     16 },
+	{      0,     17,   -110,    376,   -925,   1818,  -3051,   4960,  29332,   1252,  -1679,   1276,   -742,    332,   -105,     17 },
+	{      0,     18,   -111,    369,   -887,   1693,  -2714,   3974,  29452,   2117,  -2025,   1421,   -795,    347,   -108,     17 },
+};
+
+
+static void tick_frame_sequencer(Apu* apu);
+static void tick_sweep(Apu* apu);
+static void tick_envelope(Apu* apu);
+static void get_gains(const Apu& apu, int32_t* gains);
+static void run_square(Apu::Square* s, int ch, int32_t gain, int32_t cycles, Apu::Output* out);
+static void run_wave(Apu::Wave* wave, int32_t gain, int32_t cycles, Apu::Output* out);
+static void run_noise(Apu::Noise* noise, int32_t gain, int32_t cycles, Apu::Output* out);
+static int32_t skip_edges(int ch, int32_t period, int32_t cycles, int32_t* freq_cnt, Apu::Output* out);
+static void set_amp(int ch, int32_t amp, int32_t time, Apu::Output* out);
+static void add_delta(int32_t time, int32_t delta, Apu::Output* out);
+static void end_output_frame(const Sinks& sinks, Apu::Output* out);
+
+
+void update_apu(int32_t cycles, const Sinks& sinks, Apu* const apu)
+{
+	Apu::Output* const out = &apu->output;
+
+	// register writes since the last update may have changed the mix
+	int32_t gains[4];
+	get_gains(*apu, gains);
+	set_amp(0, apu->square1.out * gains[0], out->time, out);
+	set_amp(1, apu->square2.out * gains[1], out->time, out);
+	set_amp(2, apu->wave.out * gains[2], out->time, out);
+	set_amp(3, apu->noise.out * gains[3], out->time, out);
+
+	while (cycles > 0) {
+		int32_t step = min(cycles, kApuBlipFrameCycles - out->time);
+
+		if (apu->power) {
+			step = min(step, max(static_cast<int32_t>(apu->frame_cnt), 1));
+			run_square(&apu->square1, 0, gains[0], step, out);
+			run_square(&apu->square2, 1, gains[1], step, out);
+			run_wave(&apu->wave, gains[2], step, out);
+			run_noise(&apu->noise, gains[3], step, out);
+
+			apu->frame_cnt -= step;
+			if (apu->frame_cnt <= 0) {
+				apu->frame_cnt = kApuFrameCntTicks;
+				tick_frame_sequencer(apu);
+			}
+		}
 
-static int16_t apu_samples[kApuSamplesSize];
-static int16_t sound_buffer[kSoundBufferSize];
-static int samples_index = 0;
-static int sound_buffer_index = 0;
+		out->time += step;
+		cycles -= step;
+		if (out->time >= kApuBlipFrameCycles)
+			end_output_frame(sinks, out);
+	}
+}
 
 
+void tick_frame_sequencer(Apu* const apu)
+{
+	switch (apu->frame_step++) {
+	case 0:
+		tick_length(apu);
+		break;
+	case 2:
+		tick_length(apu);
+		tick_sweep(apu);
+		break;
+	case 4:
+		tick_length(apu);
+		break;
+	case 6:
+		tick_length(apu);
+		tick_sweep(apu);
+		break;
+	case 7:
+		tick_envelope(apu);
+		apu->frame_step = 0;
+		break;
+	}
+}
 
-static void tick_sweep(Apu* const apu)
+
+void tick_sweep(Apu* const apu)
 {
 	Apu::Square1& s = apu->square1;
 	if (--s.sweep_period_cnt <= 0) {
@@ -34,7 +141,8 @@ static void tick_sweep(Apu* const apu)
 	}
 }
 
-static void tick_envelope(Apu* const apu)
+
+void tick_envelope(Apu* const apu)
 {
 	const auto tick_square_env = [](Apu::Square* const s) {
 		if (--s->env_cnt <= 0) {
@@ -42,7 +150,7 @@ static void tick_envelope(Apu* const apu)
 
 			if (s->env_cnt == 0)
 				s->env_cnt = 8;
-			
+
 			if (s->env_period_load > 0) {
 				if (s->env_add && s->volume < 15)
 					++s->volume;
@@ -72,144 +180,182 @@ static void tick_envelope(Apu* const apu)
 	}
 }
 
-static void tick_frame_counter(Apu* const apu)
+
+void get_gains(const Apu& apu, int32_t* const gains)
+{
+	const int32_t right = (apu.rvol + 1) * kAmpScale;
+	const int32_t left = (apu.lvol + 1) * kAmpScale;
+	gains[0] = (apu.s1t1 ? right : 0) + (apu.s1t2 ? left : 0);
+	gains[1] = (apu.s2t1 ? right : 0) + (apu.s2t2 ? left : 0);
+	gains[2] = (apu.s3t1 ? right : 0) + (apu.s3t2 ? left : 0);
+	gains[3] = (apu.s4t1 ? right : 0) + (apu.s4t2 ? left : 0);
+}
+
+
+// each frequency counter reaches its next edge 'freq_cnt'
+// cycles from now, the channel output only changes there
+void run_square(Apu::Square* const s, const int ch, const int32_t gain,
+                const int32_t cycles, Apu::Output* const out)
 {
-	if (--apu->frame_cnt <= 0)  {
-		apu->frame_cnt = kApuFrameCntTicks;
-		switch (apu->frame_step++) {
-		case 0:
-			tick_length(apu);
-			break;
-		case 2:
-			tick_length(apu);
-			tick_sweep(apu);
-			break;
-		case 4:
-			tick_length(apu);
-			break;
-		case 6:
-			tick_length(apu);
-			tick_sweep(apu);
-			break;
-		case 7:
-			tick_envelope(apu);
-			apu->frame_step = 0;
-			break;
+	static const uint8_t dutytbl[4][8] = {
+		{ 0, 0, 0, 0, 0, 0, 0, 1 },
+		{ 1, 0, 0, 0, 0, 0, 0, 1 },
+		{ 1, 0, 0, 0, 0, 1, 1, 1 },
+		{ 0, 1, 1, 1, 1, 1, 1, 0 }
+	};
+
+	const int32_t period = (2048 - s->freq_load) * 4;
+
+	if (!s->enabled) {
+		const int32_t edges = skip_edges(ch, period, cycles, &s->freq_cnt, out);
+		if (edges > 0) {
+			s->duty_pos = (s->duty_pos + edges) & 0x07;
+			s->out = 0;
 		}
+		return;
+	}
+
+	int32_t t = max(s->freq_cnt, 1);
+	for (; t <= cycles; t += period) {
+		s->duty_pos = (s->duty_pos + 1) & 0x07;
+		s->out = dutytbl[s->duty_mode][s->duty_pos] ? s->volume : 0;
+		set_amp(ch, s->out * gain, out->time + t, out);
 	}
+
+	s->freq_cnt = t - cycles;
 }
 
-static void tick_freq_counters(Apu* const apu)
+
+void run_wave(Apu::Wave* const wave, const int32_t gain,
+              const int32_t cycles, Apu::Output* const out)
 {
-	const auto tick_square_freq_cnt = [](Apu::Square* const s) {
-		static const uint8_t dutytbl[4][8] = {
-			{ 0, 0, 0, 0, 0, 0, 0, 1 },
-			{ 1, 0, 0, 0, 0, 0, 0, 1 },
-			{ 1, 0, 0, 0, 0, 1, 1, 1 },
-			{ 0, 1, 1, 1, 1, 1, 1, 0 }
-		};
-
-		if (--s->freq_cnt <= 0) {
-			s->freq_cnt = (2048 - s->freq_load) * 4;
-			s->duty_pos += 1;
-			s->duty_pos &= 0x07;
-
-
-			if (!s->enabled || !dutytbl[s->duty_mode][s->duty_pos])
-				s->out = 0;
-			else
-				s->out = s->volume;
-		}
+	const int32_t period = (2048 - wave->freq_load) * 2;
+	const auto next_sample = [wave](const int32_t edges) {
+		wave->pos = (wave->pos + edges) % 32;
+		const uint8_t sample = wave->pattern_ram[wave->pos / 2];
+		wave->volume = (wave->pos&0x01) ? sample >> 4 : sample&0x0F;
 	};
 
-	tick_square_freq_cnt(&apu->square1);
-	tick_square_freq_cnt(&apu->square2);
+	if (!wave->enabled) {
+		const int32_t edges = skip_edges(2, period, cycles, &wave->freq_cnt, out);
+		if (edges > 0) {
+			next_sample(edges);
+			wave->out = 0;
+		}
+		return;
+	}
+
+	int32_t t = max(wave->freq_cnt, 1);
+	for (; t <= cycles; t += period) {
+		next_sample(1);
+		if (wave->output_level == 0)
+			wave->out = 0;
+		else
+			wave->out = wave->volume >> (wave->output_level - 1);
+		set_amp(2, wave->out * gain, out->time + t, out);
+	}
+
+	wave->freq_cnt = t - cycles;
+}
 
 
-	Apu::Wave& wave = apu->wave;
+void run_noise(Apu::Noise* const noise, const int32_t gain,
+               const int32_t cycles, Apu::Output* const out)
+{
+	const int32_t period = kNoiseDivisors[noise->divisor_code]<<noise->clock_shift;
 
-	if (--wave.freq_cnt <= 0) {
-		wave.freq_cnt = (2048 - wave.freq_load) * 2;
-		wave.pos = (wave.pos + 1) % 32;
-		const uint8_t sample = wave.pattern_ram[wave.pos / 2];
-		wave.volume = (wave.pos&0x01) ? sample >> 4 : sample&0x0F;
+	// the lfsr is reloaded on trigger, no need to keep it going
+	if (!noise->enabled) {
+		if (skip_edges(3, period, cycles, &noise->freq_cnt, out) > 0)
+			noise->out = 0;
+		return;
+	}
 
-		if (!wave.enabled || wave.output_level == 0) {
-			wave.out = 0;
-		} else {
-			wave.out = wave.volume >> (wave.output_level - 1);
+	int32_t t = max(noise->freq_cnt, 1);
+	for (; t <= cycles; t += period) {
+		const uint8_t r = (noise->lfsr&0x01) ^ ((noise->lfsr>>1)&0x01);
+		noise->lfsr >>= 1;
+		noise->lfsr |= r<<14;
+		if (noise->width_mode) {
+			noise->lfsr &= ~0x40;
+			noise->lfsr |= r<<6;
 		}
+
+		noise->out = (noise->lfsr&0x01) ? 0 : noise->volume;
+		set_amp(3, noise->out * gain, out->time + t, out);
 	}
 
+	noise->freq_cnt = t - cycles;
+}
 
-	Apu::Noise& noise = apu->noise;
-	if (--noise.freq_cnt <= 0) {
-		noise.freq_cnt = kNoiseDivisors[noise.divisor_code]<<noise.clock_shift;
-		uint8_t r = (noise.lfsr&0x01) ^ ((noise.lfsr>>1)&0x01);
-		noise.lfsr >>= 1;
-		noise.lfsr |= r<<14;
-		if (noise.width_mode) {
-			noise.lfsr &= ~0x40;
-			noise.lfsr |= r<<6;
-		}
 
+// a disabled channel outputs 0 from its next edge on,
+// so its edges are counted instead of visited
+int32_t skip_edges(const int ch, const int32_t period, const int32_t cycles,
+                   int32_t* const freq_cnt, Apu::Output* const out)
+{
+	int32_t t = max(*freq_cnt, 1);
+	int32_t edges = 0;
 
-		if (!noise.enabled || (noise.lfsr&0x01))
-			noise.out = 0;
-		else
-			noise.out = noise.volume;
+	if (t <= cycles) {
+		set_amp(ch, 0, out->time + t, out);
+		edges = 1 + (cycles - t) / period;
+		t += edges * period;
 	}
+
+	*freq_cnt = t - cycles;
+	return edges;
 }
 
 
-void update_apu(const int16_t cycles, Apu* const apu)
+void set_amp(const int ch, const int32_t amp, const int32_t time, Apu::Output* const out)
 {
-	if (!apu->power)
-		return;
+	const int32_t delta = amp - out->amps[ch];
+	if (delta != 0) {
+		out->amps[ch] = amp;
+		add_delta(time, delta, out);
+	}
+}
 
-	for (int ticks = 0; ticks < cycles; ++ticks) {
-		tick_frame_counter(apu);
-		tick_freq_counters(apu);
-
-		apu_samples[samples_index] = 0;
-
-		const auto mix = [](const int16_t out, const uint8_t vol) {
-			const int finalvol = (static_cast<long>(kAudioMaxVolume) * vol) / 7;
-			mix_audio(&apu_samples[samples_index], out, finalvol);
-		};
-
-		if (apu->s1t1)
-			mix(apu->square1.out, apu->rvol);
-		if (apu->s1t2)	
-			mix(apu->square1.out, apu->lvol);
-		if (apu->s2t1)
-			mix(apu->square2.out, apu->rvol);
-		if (apu->s2t2)
-			mix(apu->square2.out, apu->lvol);
-		if (apu->s3t1)
-			mix(apu->wave.out, apu->rvol);
-		if (apu->s3t2)
-			mix(apu->wave.out, apu->lvol);
-		if (apu->s4t1)
-			mix(apu->noise.out, apu->rvol);
-		if (apu->s4t2)
-			mix(apu->noise.out, apu->lvol);
-
-
-		if (++samples_index >= kApuSamplesSize) {
-			samples_index = 0;
-			
-			int16_t sample = 0;
-			for (int i = 0; i < kApuSamplesSize; ++i)
-				mix_audio(&sample, apu_samples[i], kAudioMaxVolume);
-			sound_buffer[sound_buffer_index] = sample;
-
-			if (++sound_buffer_index >= kSoundBufferSize) {
-				sound_buffer_index = 0;
-				queue_sound_buffer(sound_buffer, sizeof(sound_buffer));
-			}
-		}
+
+void add_delta(const int32_t time, const int32_t delta, Apu::Output* const out)
+{
+	const uint64_t pos = out->offset + static_cast<uint64_t>(time) * kBlipFactor;
+	const int phase = (pos >> (32 - kApuBlipPhaseBits)) & (kApuBlipPhases - 1);
+	const int16_t* const kernel = kBlipKernel[phase];
+	int32_t* const deltas = &out->deltas[pos >> 32];
+
+	for (int i = 0; i < kApuBlipTaps; ++i)
+		deltas[i] += kernel[i] * delta;
+}
+
+
+// integrates the steps of the whole frame into host samples,
+// leaking a little each sample to remove the dc offset
+void end_output_frame(const Sinks& sinks, Apu::Output* const out)
+{
+	const uint64_t end = out->offset + static_cast<uint64_t>(out->time) * kBlipFactor;
+	const int count = static_cast<int>(end >> 32);
+	int32_t integrator = out->integrator;
+
+	for (int i = 0; i < count; ++i) {
+		integrator += out->deltas[i];
+		const int32_t sample = integrator >> kBlipDeltaBits;
+		integrator -= sample << (kBlipDeltaBits - kBlipBassShift);
+
+		out->samples[i] = static_cast<int16_t>(max(min(sample, SHRT_MAX), SHRT_MIN));
 	}
+
+	if (sinks.audio != nullptr)
+		sinks.audio(out->samples, count, sinks.userdata);
+
+	const int size = kApuBlipSamples + kApuBlipTaps;
+	memmove(&out->deltas[0], &out->deltas[count], sizeof(int32_t) * kApuBlipTaps);
+	memset(&out->deltas[kApuBlipTaps], 0, sizeof(int32_t) * (size - kApuBlipTaps));
+
+	out->integrator = integrator;
+	out->offset = static_cast<uint32_t>(end);
+	out->time = 0;
 }
 
 
@@ -3,11 +3,24 @@
 #include <string.h>
 #include "common.hpp"
 #include "cpu.hpp"
+#include "sinks.hpp"
 
 namespace gbx {
 
 constexpr const int_fast32_t kApuFrameCntTicks = kCpuFreq / 512;
 
+// the band-limited output: amplitude steps are spread over
+// kApuBlipTaps host samples at one of kApuBlipPhases sub-sample
+// offsets and the whole frame is resampled at once every
+// kApuBlipFrameCycles ( one video frame )
+constexpr const int32_t kApuSampleRate = 44100;
+constexpr const int32_t kApuBlipFrameCycles = 70224;
+constexpr const int kApuBlipPhaseBits = 5;
+constexpr const int kApuBlipPhases = 1 << kApuBlipPhaseBits;
+constexpr const int kApuBlipTaps = 16;
+constexpr const int kApuBlipSamples =
+  static_cast<int>((static_cast<int64_t>(kApuBlipFrameCycles) * kApuSampleRate) / kCpuFreq) + 1;
+
 
 constexpr uint8_t kNoiseDivisors[] = {
 	8, 16, 32, 48, 64, 80, 96, 112
@@ -18,7 +31,7 @@ struct Apu {
 
 	struct Square {
 		int16_t freq_load;
-		int16_t freq_cnt;
+		int32_t freq_cnt;
 		int16_t len_cnt;
 		int8_t env_cnt;
 		int8_t duty_pos;
@@ -68,7 +81,7 @@ struct Apu {
 		uint8_t len_load;        // nr31 $FF1B
 		int16_t len_cnt;
 		int16_t freq_load;       // nr33 low nr34 high $FF1F $FF1E
-		int16_t freq_cnt;
+		int32_t freq_cnt;
 		uint8_t output_level;    // nr32 $FF1C
 		uint8_t volume;
 		uint8_t out;
@@ -81,7 +94,7 @@ struct Apu {
 
 	struct Noise {
 		uint16_t lfsr;
-		int16_t freq_cnt;
+		int32_t freq_cnt;
 		int16_t len_cnt;
 		int16_t env_cnt;
 		int16_t len_load;  // nr41 $FF20
@@ -137,6 +150,16 @@ struct Apu {
 	};
 
 
+	// not cleared on power off, it keeps running silent
+	struct Output {
+		int32_t deltas[kApuBlipSamples + kApuBlipTaps];
+		int32_t amps[4];         // last amplitude of each channel
+		int32_t integrator;
+		uint32_t offset;         // fraction of a sample carried between frames
+		int32_t time;            // cycles into the current frame
+		int16_t samples[kApuBlipSamples];
+	} output;
+
 	int16_t frame_cnt;
 	int8_t frame_step;
 	bool power;
@@ -144,7 +167,9 @@ struct Apu {
 
 
 
-extern void update_apu(int16_t cycles, Apu* apu);
+// runs each channel from one frequency counter edge to the next,
+// recording only the amplitude changes into the output
+extern void update_apu(int32_t cycles, const Sinks& sinks, Apu* apu);
 
 
 inline void tick_length(Apu* const apu)
@@ -339,7 +364,9 @@ inline void write_apu_register(const uint16_t addr, const uint8_t val, Apu* cons
 	case 0xFF26:
 		apu->power = (val&0x80) != 0;
 		if (!apu->power) {
+			const Apu::Output output = apu->output;
 			memset((void*)apu, 0, sizeof(*apu));
+			apu->output = output;
 			apu->frame_cnt = kApuFrameCntTicks;
 		}
 		break;
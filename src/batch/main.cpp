@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "gameboy.hpp"
+
+
+constexpr const int32_t kFrameCycles = 70224;
+constexpr const int kMaxPathSize = 1024;
+constexpr const uint64_t kHashBasis = 0xCBF29CE484222325;
+
+
+// one manifest line: rom_path frames [input_path]
+struct Task {
+	char rom_path[kMaxPathSize];
+	char input_path[kMaxPathSize];
+	int frames;
+
+	uint64_t ram_hash;
+	uint64_t frame_hash;
+	double seconds;
+	bool failed;
+};
+
+// a frame from which on 'keys' are held, bit set = pressed:
+// A, B, select, start, right, left, up, down from bit 0
+struct InputEntry {
+	int frame;
+	uint8_t keys;
+};
+
+// each worker owns a deque of task indices: it pops from the
+// bottom and, once it runs dry, steals from the top of the others
+struct Worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int* tasks;
+	int top;
+	int bottom;
+};
+
+struct Batch {
+	Task* tasks;
+	Worker* workers;
+	int ntasks;
+	int nworkers;
+	bool jit;
+};
+
+struct WorkerArg {
+	Batch* batch;
+	int id;
+};
+
+
+static Task* parse_manifest(const char* path, int* ntasks);
+static InputEntry* load_inputs(const char* path, int* nentries);
+static void* worker_main(void* arg);
+static int pop_task(Worker* worker);
+static int steal_task(Worker* worker);
+static void run_task(bool jit, Task* task);
+static void hash_frame(const gbx::Frame& frame, void* userdata);
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size);
+static double get_seconds();
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s [--threads N] [--jit] [manifest]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char* const manifest_path = argv[argc - 1];
+	int nworkers = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+	bool jit = false;
+	for (int i = 1; i < argc - 1; ++i) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc - 1) {
+			nworkers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--jit") == 0) {
+			jit = true;
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (nworkers <= 0) {
+		fprintf(stderr, "invalid thread count: %d\n", nworkers);
+		return EXIT_FAILURE;
+	}
+
+	int ntasks = 0;
+	Task* const tasks = parse_manifest(manifest_path, &ntasks);
+	if (tasks == nullptr)
+		return EXIT_FAILURE;
+
+	const auto tasks_guard = gbx::finally([tasks] {
+		free(tasks);
+	});
+
+	nworkers = gbx::min(nworkers, gbx::max(ntasks, 1));
+	Worker* const workers = (Worker*) calloc(nworkers, sizeof(Worker));
+	int* const deques = (int*) malloc(sizeof(int) * (ntasks + 1));
+	if (workers == nullptr || deques == nullptr) {
+		perror("Couldn't allocate memory");
+		free(workers);
+		free(deques);
+		return EXIT_FAILURE;
+	}
+
+	const auto workers_guard = gbx::finally([workers, deques] {
+		free(workers);
+		free(deques);
+	});
+
+	// deal the tasks round robin, each worker's share is contiguous
+	int next = 0;
+	for (int w = 0; w < nworkers; ++w) {
+		Worker& worker = workers[w];
+		pthread_mutex_init(&worker.lock, nullptr);
+		worker.tasks = &deques[next];
+		worker.top = 0;
+		worker.bottom = 0;
+		for (int t = w; t < ntasks; t += nworkers)
+			worker.tasks[worker.bottom++] = t;
+		next += worker.bottom;
+	}
+
+	Batch batch { tasks, workers, ntasks, nworkers, jit };
+	WorkerArg* const args = (WorkerArg*) malloc(sizeof(WorkerArg) * nworkers);
+	if (args == nullptr) {
+		perror("Couldn't allocate memory");
+		return EXIT_FAILURE;
+	}
+
+	const auto args_guard = gbx::finally([args] {
+		free(args);
+	});
+
+	const double begin = get_seconds();
+
+	int nstarted = 0;
+	for (int w = 0; w < nworkers; ++w) {
+		args[w] = WorkerArg { &batch, w };
+		if (pthread_create(&workers[w].thread, nullptr, worker_main, &args[w]) != 0) {
+			perror("Couldn't create thread");
+			break;
+		}
+		++nstarted;
+	}
+
+	// the workers that did start still steal every task
+	for (int w = 0; w < nstarted; ++w)
+		pthread_join(workers[w].thread, nullptr);
+
+	const double wall_seconds = get_seconds() - begin;
+
+	for (int w = 0; w < nworkers; ++w)
+		pthread_mutex_destroy(&workers[w].lock);
+
+	if (nstarted == 0)
+		return EXIT_FAILURE;
+
+	int nfailed = 0;
+	double task_seconds = 0;
+	printf("RESULTS\nrom\tframes\tram_hash\tframe_hash\tseconds\n");
+	for (int t = 0; t < ntasks; ++t) {
+		const Task& task = tasks[t];
+		if (task.failed) {
+			printf("%s\t%d\tFAILED\n", task.rom_path, task.frames);
+			++nfailed;
+			continue;
+		}
+
+		printf("%s\t%d\t%016llx\t%016llx\t%.3f\n",
+		       task.rom_path, task.frames,
+		       static_cast<unsigned long long>(task.ram_hash),
+		       static_cast<unsigned long long>(task.frame_hash),
+		       task.seconds);
+		task_seconds += task.seconds;
+	}
+
+	printf("tasks: %d\n"
+	       "failed: %d\n"
+	       "threads: %d\n"
+	       "seconds: %.3f\n"
+	       "task seconds: %.3f\n",
+	       ntasks, nfailed, nstarted, wall_seconds, task_seconds);
+
+	return nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// blank lines and lines starting with '#' are skipped
+Task* parse_manifest(const char* const path, int* const ntasks)
+{
+	FILE* const file = fopen(path, "r");
+	if (file == nullptr) {
+		perror("Couldn't open manifest");
+		return nullptr;
+	}
+
+	const auto file_guard = gbx::finally([file] {
+		fclose(file);
+	});
+
+	char line[kMaxPathSize * 2 + 64];
+	int capacity = 0;
+	int count = 0;
+	Task* tasks = nullptr;
+	int lineno = 0;
+
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		++lineno;
+		const char* p = line;
+		while (*p == ' ' || *p == '\t')
+			++p;
+		if (*p == '\0' || *p == '\n' || *p == '#')
+			continue;
+
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			Task* const grown = (Task*) realloc(tasks, sizeof(Task) * capacity);
+			if (grown == nullptr) {
+				perror("Couldn't allocate memory");
+				free(tasks);
+				return nullptr;
+			}
+			tasks = grown;
+		}
+
+		Task& task = tasks[count];
+		memset(&task, 0, sizeof(task));
+		const int fields = sscanf(p, "%1023s %d %1023s", task.rom_path, &task.frames, task.input_path);
+		if (fields < 2 || task.frames <= 0) {
+			fprintf(stderr, "%s:%d: expected 'rom_path frames [input_path]'\n", path, lineno);
+			free(tasks);
+			return nullptr;
+		}
+
+		++count;
+	}
+
+	if (count == 0) {
+		fprintf(stderr, "%s: no tasks\n", path);
+		free(tasks);
+		return nullptr;
+	}
+
+	*ntasks = count;
+	return tasks;
+}
+
+
+// lines of 'frame keys', keys as a hex mask, frames ascending
+InputEntry* load_inputs(const char* const path, int* const nentries)
+{
+	FILE* const file = fopen(path, "r");
+	if (file == nullptr) {
+		perror("Couldn't open input file");
+		return nullptr;
+	}
+
+	const auto file_guard = gbx::finally([file] {
+		fclose(file);
+	});
+
+	int capacity = 64;
+	int count = 0;
+	InputEntry* entries = (InputEntry*) malloc(sizeof(InputEntry) * capacity);
+	if (entries == nullptr) {
+		perror("Couldn't allocate memory");
+		return nullptr;
+	}
+
+	int frame;
+	unsigned keys;
+	while (fscanf(file, "%d %x", &frame, &keys) == 2) {
+		if (count == capacity) {
+			capacity *= 2;
+			InputEntry* const grown = (InputEntry*) realloc(entries, sizeof(InputEntry) * capacity);
+			if (grown == nullptr) {
+				perror("Couldn't allocate memory");
+				free(entries);
+				return nullptr;
+			}
+			entries = grown;
+		}
+
+		entries[count++] = InputEntry { frame, static_cast<uint8_t>(keys) };
+	}
+
+	*nentries = count;
+	return entries;
+}
+
+
+void* worker_main(void* const arg)
+{
+	const WorkerArg& warg = *static_cast<WorkerArg*>(arg);
+	Batch& batch = *warg.batch;
+	Worker* const self = &batch.workers[warg.id];
+
+	for (;;) {
+		int task = pop_task(self);
+
+		// no task is ever added, so once every deque
+		// has been found empty the batch is done
+		for (int i = 1; task < 0 && i < batch.nworkers; ++i)
+			task = steal_task(&batch.workers[(warg.id + i) % batch.nworkers]);
+
+		if (task < 0)
+			break;
+
+		run_task(batch.jit, &batch.tasks[task]);
+	}
+
+	return nullptr;
+}
+
+
+int pop_task(Worker* const worker)
+{
+	pthread_mutex_lock(&worker->lock);
+	const int task = worker->bottom > worker->top ? worker->tasks[--worker->bottom] : -1;
+	pthread_mutex_unlock(&worker->lock);
+	return task;
+}
+
+
+int steal_task(Worker* const worker)
+{
+	pthread_mutex_lock(&worker->lock);
+	const int task = worker->bottom > worker->top ? worker->tasks[worker->top++] : -1;
+	pthread_mutex_unlock(&worker->lock);
+	return task;
+}
+
+
+void run_task(const bool jit, Task* const task)
+{
+	task->failed = true;
+
+	InputEntry* inputs = nullptr;
+	int ninputs = 0;
+	if (task->input_path[0] != '\0') {
+		inputs = load_inputs(task->input_path, &ninputs);
+		if (inputs == nullptr)
+			return;
+	}
+
+	const auto inputs_guard = gbx::finally([inputs] {
+		free(inputs);
+	});
+
+	// results only depend on the task: no state
+	// from earlier runs, no file written next to the rom
+	gbx::Gameboy* const gb = gbx::create_gameboy(task->rom_path, gbx::SavFile::Ignore);
+	if (gb == nullptr)
+		return;
+
+	const auto gb_guard = gbx::finally([gb] {
+		gbx::destroy_gameboy(gb);
+	});
+
+	if (jit && !gbx::set_cpu_backend(gbx::CpuBackend::Jit, gb))
+		return;
+
+	task->frame_hash = kHashBasis;
+	gb->sinks.frame = hash_frame;
+	gb->sinks.userdata = &task->frame_hash;
+
+	const double begin = get_seconds();
+
+	int next_input = 0;
+	for (int frame = 0; frame < task->frames; ++frame) {
+		while (next_input < ninputs && inputs[next_input].frame <= frame)
+			gbx::set_joypad_keys(~inputs[next_input++].keys, &gb->hwstate, &gb->joypad);
+		gbx::run_for(kFrameCycles, gb);
+	}
+
+	task->seconds = get_seconds() - begin;
+
+	const gbx::Memory& mem = gb->memory;
+	const gbx::CartInfo& info = gb->cart.info;
+	uint64_t hash = hash_bytes(kHashBasis, mem.wram, sizeof(mem.wram));
+	hash = hash_bytes(hash, mem.hram, sizeof(mem.hram));
+	task->ram_hash = hash_bytes(hash, &gb->cart.data[info.rom_size()], info.ram_size());
+	task->failed = false;
+}
+
+
+// FNV-1a over 8 indexed pixels at a time, a byte at a time costs more
+// than the frame. the indices and the line palettes and splits are what
+// the frame looks like, there is no need to convert it to colors
+void hash_frame(const gbx::Frame& frame, void* const userdata)
+{
+	static_assert(sizeof(frame.pixels) % 8 == 0, "");
+	uint64_t hash = *static_cast<uint64_t*>(userdata);
+	const uint8_t* const pixels = &frame.pixels[0][0];
+	for (size_t i = 0; i < sizeof(frame.pixels); i += 8) {
+		uint64_t chunk;
+		memcpy(&chunk, &pixels[i], sizeof(chunk));
+		hash ^= chunk;
+		hash *= 0x100000001B3;
+	}
+	hash = hash_bytes(hash, frame.palettes, sizeof(frame.palettes));
+	for (int y = 0; y < 144; ++y) {
+		const int count = frame.split_counts[y];
+		hash = hash_bytes(hash, &frame.split_counts[y], 1);
+		hash = hash_bytes(hash, frame.splits[y], sizeof(gbx::PaletteSplit) * count);
+	}
+	*static_cast<uint64_t*>(userdata) = hash;
+}
+
+
+// FNV-1a
+uint64_t hash_bytes(uint64_t hash, const void* const data, const size_t size)
+{
+	const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+
+double get_seconds()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
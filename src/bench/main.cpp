@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gameboy.hpp"
+
+
+static long count_instructions(const char* rom_path, int frames);
+static double run_timed(const char* rom_path, int frames);
+
+
+constexpr const int32_t kFrameCycles = 70224;
+
+#ifdef GBX_THREADED_DISPATCH
+constexpr const char* const kDispatchMode = "threaded";
+#else
+constexpr const char* const kDispatchMode = "table";
+#endif
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s [rom] [frames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char* const rom_path = argv[1];
+	const int frames = argc > 2 ? atoi(argv[2]) : 3000;
+
+	if (frames <= 0) {
+		fprintf(stderr, "invalid frame count: %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	const long instructions = count_instructions(rom_path, frames);
+	if (instructions < 0)
+		return EXIT_FAILURE;
+
+	const double seconds = run_timed(rom_path, frames);
+	if (seconds < 0)
+		return EXIT_FAILURE;
+
+	printf("dispatch: %s\n"
+	       "frames: %d\n"
+	       "instructions: %ld\n"
+	       "seconds: %.3f\n"
+	       "IPS: %.0f\n"
+	       "FPS: %.1f\n",
+	       kDispatchMode, frames, instructions, seconds,
+	       instructions / seconds, frames / seconds);
+
+	return EXIT_SUCCESS;
+}
+
+
+// the timed run can't count instructions without slowing
+// down dispatch, so they are counted on a separate stepped run
+long count_instructions(const char* const rom_path, const int frames)
+{
+	gbx::Gameboy* const gb = gbx::create_gameboy(rom_path);
+	if (gb == nullptr)
+		return -1;
+
+	const auto gb_guard = gbx::finally([gb] {
+		gbx::destroy_gameboy(gb);
+	});
+
+	const int64_t total_cycles = int64_t(kFrameCycles) * frames;
+	int64_t cycles = 0;
+	long instructions = 0;
+	while (cycles < total_cycles) {
+		const int32_t clock = gb->cpu.clock;
+		const bool halted = gb->hwstate.flags.cpu_halt;
+		gbx::run_for(1, gb);
+		cycles += gb->cpu.clock - clock + 1;
+		instructions += !halted;
+	}
+
+	return instructions;
+}
+
+
+double run_timed(const char* const rom_path, const int frames)
+{
+	gbx::Gameboy* const gb = gbx::create_gameboy(rom_path);
+	if (gb == nullptr)
+		return -1;
+
+	const auto gb_guard = gbx::finally([gb] {
+		gbx::destroy_gameboy(gb);
+	});
+
+	timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for (int i = 0; i < frames; ++i)
+		gbx::run_for(kFrameCycles, gb);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
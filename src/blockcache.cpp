@@ -0,0 +1,157 @@
+#include <string.h>
+#include "gameboy.hpp"
+#include "blockcache.hpp"
+#include "idleloop.hpp"
+
+namespace gbx {
+
+static void decode_block(uint16_t pc, uint16_t region_end,
+                         int32_t bank, Gameboy* gb, Block* block);
+static bool is_block_end(uint8_t opcode);
+static void mark_code(uint16_t address, int length, Gameboy* gb);
+
+
+Block* fetch_block(Gameboy* const gb)
+{
+	const uint16_t pc = gb->cpu.pc;
+
+	// only regions where code can't change without
+	// going through mem_write8 are cached
+	int32_t bank = 0;
+	uint16_t region_end;
+	if (pc < 0x4000) {
+		region_end = 0x4000;
+	} else if (pc < 0x8000) {
+		bank = gb->cart.rom_bank_offset;
+		region_end = 0x8000;
+	} else if (pc >= 0xC000 && pc < 0xE000) {
+		region_end = 0xE000;
+	} else if (pc >= 0xFF80 && pc < 0xFFFF) {
+		region_end = 0xFFFF;
+	} else {
+		return nullptr;
+	}
+
+	const auto index = (pc ^ (bank >> 8)) & (kBlockCacheSize - 1);
+	Block* const block = &gb->blkcache.blocks[index];
+	if (block->nops == 0 || block->pc != pc || block->bank != bank)
+		decode_block(pc, region_end, bank, gb, block);
+
+	return block->nops != 0 ? block : nullptr;
+}
+
+
+void invalidate_ram_blocks(Gameboy* const gb)
+{
+	BlockCache* const cache = &gb->blkcache;
+	for (Block& block : cache->blocks) {
+		if (block.pc >= 0x8000)
+			block.nops = 0;
+	}
+
+	memset(cache->code_marks, 0, sizeof(cache->code_marks));
+	cache->break_block = true;
+
+	if (cache->code_pages != 0) {
+		cache->code_pages = 0;
+		update_page_table(gb);
+	}
+}
+
+
+void decode_block(const uint16_t pc, const uint16_t region_end,
+                  const int32_t bank, Gameboy* const gb, Block* const block)
+{
+	block->native = nullptr;
+	block->bank = bank;
+	block->pc = pc;
+	block->cycles = 0;
+	block->nops = 0;
+	block->hits = 0;
+
+	int_fast32_t address = pc;
+	while (block->nops < kBlockMaxOps) {
+		const uint8_t opcode = mem_read8(*gb, address);
+		const uint8_t length = length_table[opcode];
+		if (address + length > region_end)
+			break;
+
+		BlockOp& op = block->ops[block->nops++];
+		op.opcode = opcode;
+		op.length = length;
+		if (opcode != 0xCB) {
+			op.handler = main_instructions[opcode];
+			op.fetch = 1;
+			op.cycles = clock_table[opcode];
+		} else {
+			const uint8_t cb_op = mem_read8(*gb, address + 1);
+			op.handler = cb_instructions[cb_op];
+			op.fetch = 2;
+			op.cycles = get_cb_clock(cb_op);
+		}
+
+		block->cycles += op.cycles;
+		address += length;
+
+		if (is_block_end(opcode))
+			break;
+	}
+
+	block->idle = block->nops != 0 && is_idle_loop(*block, *gb);
+
+	if (pc >= 0x8000 && block->nops != 0)
+		mark_code(pc, address - pc, gb);
+}
+
+
+bool is_block_end(const uint8_t opcode)
+{
+	switch (opcode) {
+	// STOP, HALT
+	case 0x10: case 0x76:
+	// JR
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+	// JP
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:
+	// CALL
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+	// RET, RETI
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:
+	// RST
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+	case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+	// undefined opcodes
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4:
+	case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+void mark_code(const uint16_t address, const int length, Gameboy* const gb)
+{
+	BlockCache* const cache = &gb->blkcache;
+	if (address >= 0xFF80) {
+		const int offset = (address - 0xFF80) + kBlockHramMarksOffset;
+		memset(&cache->code_marks[offset], 1, length);
+		return;
+	}
+
+	const int offset = address - 0xC000;
+	memset(&cache->code_marks[offset], 1, length);
+
+	// writes to these pages now have to go through write_wram
+	const uint8_t pages = (1 << (offset >> kPageShift)) |
+	                      (1 << ((offset + length - 1) >> kPageShift));
+	if ((cache->code_pages | pages) != cache->code_pages) {
+		cache->code_pages |= pages;
+		update_page_table(gb);
+	}
+}
+
+
+
+} // namespace gbx
+
@@ -0,0 +1,59 @@
+#ifndef GBX_BLOCKCACHE_HPP_
+#define GBX_BLOCKCACHE_HPP_
+#include "common.hpp"
+#include "instructions.hpp"
+
+namespace gbx {
+
+constexpr const int kBlockMaxOps = 16;
+constexpr const int kBlockCacheSize = 1024;
+constexpr const int kBlockHramMarksOffset = 8_Kib;
+
+using BlockFn = void(*)(Gameboy*, int32_t clock_limit);
+
+
+// a pre-decoded instruction: the handler runs with cpu.pc already
+// advanced by 'fetch' bytes (the opcode, plus the $CB prefix byte for
+// CB instructions) and is expected to consume up to 'length' bytes
+struct BlockOp {
+	InstructionPtr handler;
+	uint8_t opcode;
+	uint8_t fetch;
+	uint8_t length;
+	uint8_t cycles;
+};
+
+// a straight-line run of instructions, keyed by pc and the rom bank
+// offset mapped at the time it was decoded ( 0 outside $4000 - $7FFF ).
+// 'native' is set once the jit has translated a hot block and
+// 'idle' if it's a loop whose iterations skip_idle_loop may skip
+struct Block {
+	BlockFn native;
+	int32_t bank;
+	uint16_t pc;
+	uint16_t cycles;
+	uint8_t nops;
+	uint8_t hits;
+	bool idle;
+	BlockOp ops[kBlockMaxOps];
+};
+
+struct BlockCache {
+	Block blocks[kBlockCacheSize];
+	// one mark per WRAM / HRAM byte covered by a cached block
+	uint8_t code_marks[8_Kib + 127];
+	// one bit per 4 KiB WRAM page with marks, those
+	// pages are left out of the page table's writes
+	uint8_t code_pages;
+	// set by writes that may change code under the running block
+	bool break_block;
+};
+
+
+extern Block* fetch_block(Gameboy* gb);
+extern void invalidate_ram_blocks(Gameboy* gb);
+
+
+} // namespace gbx
+#endif
+
@@ -6,8 +6,6 @@
 
 namespace gbx {
 
-CartInfo g_cart_info;
-
 inline void reset(Gameboy* gb);
 
 inline bool extract_rom_header_info(FILE* rom_file,
@@ -26,7 +24,7 @@ inline bool load_sav_file(const char* sav_file_path, Cart* cart);
 inline void update_sav_file(const Cart& cart, const char* sav_file_path);
 
 
-Gameboy* create_gameboy(const char* const rom_file_path)
+Gameboy* create_gameboy(const char* const rom_file_path, const SavFile sav)
 {
 	FILE* const rom_file = fopen(rom_file_path, "rb");
 
@@ -41,22 +39,23 @@ Gameboy* create_gameboy(const char* const rom_file_path)
 	});
 
 
+	CartInfo info {};
 	const bool success =
 	  extract_rom_header_info(rom_file,
-	                          &g_cart_info.m_internal_name,
-	                          &g_cart_info.m_type,
-	                          &g_cart_info.m_short_type,
-	                          &g_cart_info.m_system,
-	                          &g_cart_info.m_rom_size,
-	                          &g_cart_info.m_ram_size,
-	                          &g_cart_info.m_rom_banks,
-	                          &g_cart_info.m_ram_banks);
+	                          &info.m_internal_name,
+	                          &info.m_type,
+	                          &info.m_short_type,
+	                          &info.m_system,
+	                          &info.m_rom_size,
+	                          &info.m_ram_size,
+	                          &info.m_rom_banks,
+	                          &info.m_ram_banks);
 
 	if (!success)
 		return nullptr;
 
 
-	const size_t memsize = sizeof(Gameboy) + g_cart_info.m_rom_size + g_cart_info.m_ram_size;
+	const size_t memsize = sizeof(Gameboy) + info.m_rom_size + info.m_ram_size;
 	Gameboy* const gb = (Gameboy*) malloc(memsize);
 	if (gb == nullptr) {
 		perror("Couldn't allocate memory");
@@ -67,30 +66,34 @@ Gameboy* create_gameboy(const char* const rom_file_path)
 		destroy_gameboy(gb);
 	});
 
+	gb->cart.info = info;
 	reset(gb);
+	memset(&gb->cart.data[info.m_rom_size], 0, info.m_ram_size);
 
-	if (is_in_array(kBatteryCartridgeTypes, g_cart_info.m_type)) {
-		g_cart_info.m_sav_file_path = eval_sav_file_path(rom_file_path);
-		if (g_cart_info.m_sav_file_path == nullptr || !load_sav_file(g_cart_info.m_sav_file_path, &gb->cart))
+	CartInfo& cart_info = gb->cart.info;
+	if (sav == SavFile::Use && is_in_array(kBatteryCartridgeTypes, cart_info.m_type)) {
+		cart_info.m_sav_file_path = eval_sav_file_path(rom_file_path);
+		if (cart_info.m_sav_file_path == nullptr || !load_sav_file(cart_info.m_sav_file_path, &gb->cart))
 			return nullptr;
 	}
 
 	if (!extract_rom_data(rom_file, &gb->cart))
 		return nullptr;
 
-	printf("CARTRIDGE INFO\n"
-	       "NAME: %s\n"
-	       "ROM SIZE: %u\n"
-	       "RAM SIZE: %u\n"
-	       "ROM BANKS: %u\n"
-	       "RAM BANKS: %u\n"
-	       "TYPE CODE: %u\n"
-	       "SYSTEM CODE: %u\n",
-	       g_cart_info.m_internal_name,
-	       g_cart_info.m_rom_size, g_cart_info.m_ram_size,
-	       g_cart_info.m_rom_banks, g_cart_info.m_ram_banks,
-	       static_cast<int>(g_cart_info.m_type),
-	       static_cast<int>(g_cart_info.m_system));
+	// stderr keeps the frontends' stdout to their own output
+	fprintf(stderr, "CARTRIDGE INFO\n"
+	        "NAME: %s\n"
+	        "ROM SIZE: %u\n"
+	        "RAM SIZE: %u\n"
+	        "ROM BANKS: %u\n"
+	        "RAM BANKS: %u\n"
+	        "TYPE CODE: %u\n"
+	        "SYSTEM CODE: %u\n",
+	        cart_info.m_internal_name,
+	        cart_info.m_rom_size, cart_info.m_ram_size,
+	        cart_info.m_rom_banks, cart_info.m_ram_banks,
+	        static_cast<int>(cart_info.m_type),
+	        static_cast<int>(cart_info.m_system));
 
 	gb_guard.abort();
 	return gb;
@@ -99,10 +102,14 @@ Gameboy* create_gameboy(const char* const rom_file_path)
 
 void destroy_gameboy(Gameboy* gb)
 {
-	if (g_cart_info.m_sav_file_path != nullptr) {
-		update_sav_file(gb->cart, g_cart_info.m_sav_file_path);
-		free(g_cart_info.m_sav_file_path);
-		g_cart_info.m_sav_file_path = nullptr;
+	set_cpu_backend(CpuBackend::Interpreter, gb);
+	set_ppu_async(false, gb);
+
+	CartInfo& cart_info = gb->cart.info;
+	if (cart_info.m_sav_file_path != nullptr) {
+		update_sav_file(gb->cart, cart_info.m_sav_file_path);
+		free(cart_info.m_sav_file_path);
+		cart_info.m_sav_file_path = nullptr;
 	}
 
 	free(gb);
@@ -111,7 +118,10 @@ void destroy_gameboy(Gameboy* gb)
 
 void reset(Gameboy* const gb)
 {
+	// everything but the cartridge header info
+	const CartInfo info = gb->cart.info;
 	memset((void*)gb, 0, sizeof(*gb));
+	gb->cart.info = info;
 
 	// init the system
 	// up to now only Gameboy (DMG) mode is supported
@@ -124,9 +134,9 @@ void reset(Gameboy* const gb)
 
 	gb->ppu.lcdc.value = 0x91;
 	gb->ppu.stat.value = 0x85;
-	write_palette(0xFC, &gb->ppu.bgp);
-	write_palette(0xFF, &gb->ppu.obp0);
-	write_palette(0xFF, &gb->ppu.obp1);
+	gb->ppu.bgp = 0xFC;
+	gb->ppu.obp0 = 0xFF;
+	gb->ppu.obp1 = 0xFF;
 
 	gb->apu.power = true;
 	gb->apu.frame_cnt = kApuFrameCntTicks;
@@ -135,12 +145,17 @@ void reset(Gameboy* const gb)
 	gb->hwstate.tac = 0xF8;
 	gb->joypad.reg.value = 0xFF;
 	gb->joypad.keys.both = 0xFF;
+	gb->idle.enabled = true;
+	update_page_table(gb);
+
+	for (int i = 0; i < kEventCount; ++i)
+		schedule_event(static_cast<Event>(i), gb);
 }
 
 
 bool extract_rom_data(FILE* const rom_file, Cart* const cart)
 {
-	const size_t rom_size = g_cart_info.rom_size();
+	const size_t rom_size = cart->info.rom_size();
 
 	errno = 0;
 	if (fseek(rom_file, 0, SEEK_SET) != 0 || fread(cart->data, 1, rom_size, rom_file) < rom_size) {
@@ -202,8 +217,8 @@ bool load_sav_file(const char* const sav_file_path, Cart* const cart)
 
 	const auto sav_file_guard = finally([sav_file] { fclose(sav_file); });
 
-	const size_t ram_size = g_cart_info.ram_size();
-	uint8_t* const ram = &cart->data[g_cart_info.rom_size()];
+	const size_t ram_size = cart->info.ram_size();
+	uint8_t* const ram = &cart->data[cart->info.rom_size()];
 	if (fread(ram, 1, ram_size, sav_file) < ram_size)
 		fputs("Error while reading sav file\n", stderr);
 
@@ -224,8 +239,8 @@ void update_sav_file(const Cart& cart, const char* const sav_file_path)
 		fclose(sav_file);
 	});
 
-	const size_t ram_size = g_cart_info.ram_size();
-	const uint8_t* const ram = &cart.data[g_cart_info.rom_size()];
+	const size_t ram_size = cart.info.ram_size();
+	const uint8_t* const ram = &cart.data[cart.info.rom_size()];
 
 	if (fwrite(ram, 1, ram_size, sav_file) < ram_size)
 		perror("Error while updating sav file");
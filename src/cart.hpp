@@ -28,6 +28,14 @@ enum class CartSystem : uint8_t {
 	GameboyColorOnly
 };
 
+// whether a battery cart's ram is loaded from <rom>.sav and written
+// back to it by destroy_gameboy. with Ignore it starts zeroed like any
+// other cart's and no file is touched
+enum class SavFile : uint8_t {
+	Use,
+	Ignore
+};
+
 enum CartBankingMode : uint8_t {
 	kRomBankingMode,
 	kRamBankingMode
@@ -53,6 +61,36 @@ constexpr const CartType kBatteryCartridgeTypes[]{
 };
 
 
+class CartInfo {
+public:
+	const char* internal_name() const { return m_internal_name; }
+	uint32_t rom_size() const { return m_rom_size; }
+	uint32_t ram_size() const { return m_ram_size; }
+	uint8_t rom_banks() const { return m_rom_banks; }
+	uint8_t ram_banks() const { return m_ram_banks; }
+	CartType type()     const { return m_type; }
+	CartShortType short_type() const { return m_short_type; }
+	CartSystem system()        const { return m_system; }
+
+private:
+	friend Gameboy* create_gameboy(const char*, SavFile);
+	friend void destroy_gameboy(Gameboy*);
+
+	char m_internal_name[17];
+	char* m_sav_file_path;
+
+	uint32_t m_rom_size;
+	uint32_t m_ram_size;
+	uint8_t m_rom_banks;
+	uint8_t m_ram_banks;
+
+	CartType m_type;
+	CartShortType m_short_type;
+	CartSystem m_system;
+
+};
+
+
 struct Cart {
 	union {
 		union {
@@ -75,43 +113,15 @@ struct Cart {
 		const int32_t ram_enabled;
 	};
 
+	CartInfo info;
 	uint8_t data[];
 };
 
 
-extern class CartInfo {
-public:
-	const char* internal_name() const { return m_internal_name; }
-	uint32_t rom_size() const { return m_rom_size; }
-	uint32_t ram_size() const { return m_ram_size; }
-	uint8_t rom_banks() const { return m_rom_banks; }
-	uint8_t ram_banks() const { return m_ram_banks; }
-	CartType type()     const { return m_type; }
-	CartShortType short_type() const { return m_short_type; }
-	CartSystem system()        const { return m_system; }
-
-private:
-	friend Gameboy* create_gameboy(const char*);
-	friend void destroy_gameboy(Gameboy*);
-
-	char m_internal_name[17] { 0 };
-	char* m_sav_file_path = nullptr;
-
-	uint32_t m_rom_size = 0;
-	uint32_t m_ram_size = 0;
-	uint8_t m_rom_banks = 0;
-	uint8_t m_ram_banks = 0;
-
-	CartType m_type = CartType::RomOnly;
-	CartShortType m_short_type = CartShortType::RomOnly;
-	CartSystem m_system = CartSystem::Gameboy;
-
-} g_cart_info;
-
 
 inline void enable_ram(Cart* const cart) 
 {
-	cart->ram_bank_offset = g_cart_info.rom_size() - 0xA000;
+	cart->ram_bank_offset = cart->info.rom_size() - 0xA000;
 }
 
 
@@ -0,0 +1,102 @@
+#include <string.h>
+#include "frame.hpp"
+
+namespace gbx {
+
+template<class T>
+static void convert_pixels(const Frame& frame, const T(&shades)[4], T* dest);
+template<class T>
+static void fill_lut(const uint8_t(&palettes)[3], const T(&shades)[4], T(&lut)[16]);
+
+
+void convert_frame(const Frame& frame, const PixelFormat format, void* const dest)
+{
+	switch (format) {
+	case PixelFormat::Argb8888: {
+		constexpr const uint32_t shades[4] { kWhite, kLightGrey, kDarkGrey, kBlack };
+		convert_pixels(frame, shades, static_cast<uint32_t*>(dest));
+		break;
+	}
+	case PixelFormat::Rgb565: {
+		constexpr const uint16_t shades[4] { 0xFFFF, 0x9492, 0x52AA, 0x0000 };
+		convert_pixels(frame, shades, static_cast<uint16_t*>(dest));
+		break;
+	}
+	case PixelFormat::Gray8: {
+		constexpr const uint8_t shades[4] { 0xFF, 0x90, 0x55, 0x00 };
+		convert_pixels(frame, shades, static_cast<uint8_t*>(dest));
+		break;
+	}
+	}
+}
+
+
+void init_frame_ring(FrameRing* const ring)
+{
+	ring->write = 0;
+	ring->ready.store(1, std::memory_order_relaxed);
+	ring->read = 2;
+	ring->dropped.store(0, std::memory_order_relaxed);
+}
+
+
+void publish_frame(const Frame& frame, FrameRing* const ring)
+{
+	memcpy(&ring->frames[ring->write], &frame, sizeof(frame));
+	const uint8_t last = ring->ready.exchange(ring->write | kFrameFresh, std::memory_order_acq_rel);
+	if (last & kFrameFresh)
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+	ring->write = last & ~kFrameFresh;
+}
+
+
+const Frame* poll_frame(FrameRing* const ring)
+{
+	if (!(ring->ready.load(std::memory_order_relaxed) & kFrameFresh))
+		return nullptr;
+
+	ring->read = ring->ready.exchange(ring->read, std::memory_order_acq_rel) & ~kFrameFresh;
+	return &ring->frames[ring->read];
+}
+
+
+// each line goes through a 16 entries table indexed by the pixel
+// itself, built again at each of the line's palette splits
+template<class T>
+void convert_pixels(const Frame& frame, const T(&shades)[4], T* dest)
+{
+	for (int y = 0; y < 144; ++y) {
+		T lut[16];
+		fill_lut(frame.palettes[y], shades, lut);
+
+		const uint8_t* const pixels = frame.pixels[y];
+		int x = 0;
+		for (int i = 0; i < frame.split_counts[y]; ++i) {
+			const PaletteSplit& split = frame.splits[y][i];
+			for (; x < split.x; ++x)
+				*dest++ = lut[pixels[x]];
+			fill_lut(split.values, shades, lut);
+		}
+
+		for (; x < 160; ++x)
+			*dest++ = lut[pixels[x]];
+	}
+}
+
+
+template<class T>
+void fill_lut(const uint8_t(&palettes)[3], const T(&shades)[4], T(&lut)[16])
+{
+	for (int pal = kPaletteBgp; pal <= kPaletteObp1; ++pal) {
+		const uint8_t value = palettes[pal];
+		for (int colnum = 0; colnum < 4; ++colnum)
+			lut[(pal << 2) | colnum] = shades[(value >> (colnum * 2)) & 0x03];
+	}
+
+	for (int colnum = 0; colnum < 4; ++colnum)
+		lut[(kPaletteBlank << 2) | colnum] = shades[0];
+}
+
+
+} // namespace gbx
+
@@ -0,0 +1,88 @@
+#ifndef GBX_FRAME_HPP_
+#define GBX_FRAME_HPP_
+#include <atomic>
+#include "common.hpp"
+
+namespace gbx {
+
+
+enum Color : uint32_t {
+	kBlack = 0x00000000,
+	kWhite = 0x00FFFFFF,
+	kLightGrey = 0x00909090,
+	kDarkGrey = 0x00555555
+};
+
+// bits 2-3 of a pixel, the palette its color number goes through.
+// blank is what a line shows with the background off, always white
+enum PaletteId : uint8_t {
+	kPaletteBgp = 0,
+	kPaletteObp0 = 1,
+	kPaletteObp1 = 2,
+	kPaletteBlank = 3
+};
+
+enum class PixelFormat : uint8_t {
+	Argb8888,
+	Rgb565,
+	Gray8
+};
+
+
+constexpr const int kPaletteSplitsMax = 8;
+constexpr const int kFrameRingSize = 3;
+constexpr const uint8_t kFrameFresh = 0x80;
+
+
+// palette register values taking effect from pixel 'x' of a line on
+struct PaletteSplit {
+	uint8_t x;
+	uint8_t values[3];
+};
+
+// the screen as the ppu draws it, each pixel holds its color number in
+// bits 0-1 and its PaletteId in bits 2-3. the palette registers are
+// recorded as each line starts, along with the changes made while it
+// was drawn, so converting the frame later gives the same colors even
+// when a game changes them mid-frame or mid-line
+struct Frame {
+	uint8_t pixels[144][160];
+	uint8_t palettes[144][3];
+	uint8_t split_counts[144];
+	PaletteSplit splits[144][kPaletteSplitsMax];
+};
+
+// hands frames from the thread running the frame sink to the one
+// presenting them, neither ever waits for the other. the producer
+// fills 'write', the consumer reads 'read', and 'ready' is the last
+// frame published, with kFrameFresh set until the consumer takes it.
+// each side swaps its slot with 'ready'. frames published over one
+// the consumer didn't take count as 'dropped'
+struct FrameRing {
+	Frame frames[kFrameRingSize];
+	std::atomic<uint8_t> ready;
+	std::atomic<uint32_t> dropped;
+	uint8_t write;
+	uint8_t read;
+};
+
+
+// writes 160x144 pixels of 'format' to 'dest', tightly packed
+extern void convert_frame(const Frame& frame, PixelFormat format, void* dest);
+
+extern void init_frame_ring(FrameRing* ring);
+// copies 'frame' to the ring, from the producer's thread
+extern void publish_frame(const Frame& frame, FrameRing* ring);
+// the frame published since the last poll, or nullptr if there
+// is none. it stays valid until the next poll, consumer side
+extern const Frame* poll_frame(FrameRing* ring);
+
+inline uint8_t get_pixel_color_number(const uint8_t pixel)
+{
+	return pixel & 0x03;
+}
+
+
+} // namespace gbx
+#endif
+
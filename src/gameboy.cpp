@@ -4,40 +4,198 @@
 
 namespace gbx {
 
-static void update_timers(int16_t cycles, HWState* hwstate);
-static void update_interrupts(Gameboy* gb);
+static void exec_cached_block(Block* block, int32_t clock_limit, Gameboy* gb);
+#ifndef GBX_THREADED_DISPATCH
+static void exec_block(const Block& block, int32_t clock_limit, Gameboy* gb);
+#endif
+static void exec_step(int32_t clock_limit, Gameboy* gb);
+static void update_timers(int32_t cycles, HWState* hwstate);
 
 
 void run_for(const int32_t clock_limit, Gameboy* const gb)
 {
 	do {
-		const int32_t prevclk = gb->cpu.clock;
+		Block* const block =
+		  !gb->hwstate.flags.cpu_halt ? fetch_block(gb) : nullptr;
 
-		if (!gb->hwstate.flags.cpu_halt) {
-			const uint8_t opcode = mem_read8(*gb, gb->cpu.pc++);
-			main_instructions[opcode](gb);
-			gb->cpu.clock += clock_table[opcode];
+		if (block == nullptr) {
+			exec_step(clock_limit, gb);
+		} else if (!block->idle || !gb->idle.enabled) {
+			exec_cached_block(block, clock_limit, gb);
 		} else {
-			gb->cpu.clock += 4;
-		}
+			IdleLoopEntry entry;
+			entry.cpu = gb->cpu;
+			entry.ime = gb->hwstate.flags.ime;
+			memcpy(entry.deadlines, gb->sched.deadlines, sizeof(entry.deadlines));
 
-		const auto step_cycles = static_cast<int16_t>(gb->cpu.clock - prevclk);
+			exec_cached_block(block, clock_limit, gb);
+			skip_idle_loop(*block, entry, clock_limit, gb);
+		}
 
-		update_ppu(step_cycles, gb->memory, &gb->hwstate, &gb->ppu);
-		update_apu(step_cycles, &gb->apu);
-		update_timers(step_cycles, &gb->hwstate);
-		update_interrupts(gb);
-		
 	} while (gb->cpu.clock < clock_limit);
 
 	gb->cpu.clock -= clock_limit;
+	shift_events(-clock_limit, &gb->sched);
+}
+
+
+void exec_cached_block(Block* const block, const int32_t clock_limit, Gameboy* const gb)
+{
+	if (block->native != nullptr || (gb->jit.enabled && jit_compile(block, gb)))
+		block->native(gb, clock_limit);
+#ifdef GBX_THREADED_DISPATCH
+	else
+		exec_block_threaded(*block, clock_limit, gb);
+#else
+	else
+		exec_block(*block, clock_limit, gb);
+#endif
+}
+
+
+#ifndef GBX_THREADED_DISPATCH
+void exec_block(const Block& block, const int32_t clock_limit, Gameboy* const gb)
+{
+	// the clock limit can only be reached inside
+	// this block if its cycles don't fit before it
+	const bool check_limit = gb->cpu.clock + block.cycles >= clock_limit;
+	uint16_t next_pc = block.pc;
+
+	gb->blkcache.break_block = false;
+
+	for (int i = 0; i < block.nops; ++i) {
+		const BlockOp& op = block.ops[i];
+
+		next_pc += op.length;
+		gb->cpu.pc += op.fetch;
+		op.handler(gb);
+		gb->cpu.clock += op.cycles;
+
+		update_hardware(gb);
+
+		// leave on jumps, interrupts or code changes
+		if (gb->cpu.pc != next_pc || gb->blkcache.break_block ||
+		    (check_limit && gb->cpu.clock >= clock_limit))
+			break;
+	}
+}
+#endif
+
+
+void exec_step(const int32_t clock_limit, Gameboy* const gb)
+{
+	if (!gb->hwstate.flags.cpu_halt) {
+		const uint8_t opcode = mem_read8(*gb, gb->cpu.pc++);
+		main_instructions[opcode](gb);
+		gb->cpu.clock += clock_table[opcode];
+	} else {
+		// only the ppu and the timers can raise an interrupt while
+		// halted ( the joypad's is raised between run_for calls ), so
+		// skip the 4 cycle steps up to the first one reaching them
+		const int32_t* const deadlines = gb->sched.deadlines;
+		const int32_t target =
+		  min(min(deadlines[static_cast<int>(Event::Ppu)],
+		          deadlines[static_cast<int>(Event::Timers)]), clock_limit);
+		const int32_t steps = max((target - gb->cpu.clock + 3) / 4, 1);
+		gb->cpu.clock += steps * 4;
+	}
+
+	update_hardware(gb);
+}
+
+
+void run_events(Gameboy* const gb)
+{
+	for (int i = 0; i < kEventCount; ++i) {
+		if (gb->cpu.clock >= gb->sched.deadlines[i])
+			sync_event(static_cast<Event>(i), gb);
+	}
+}
+
+
+void sync_event(const Event event, Gameboy* const gb)
+{
+	int32_t& synced = gb->sched.synced[static_cast<int>(event)];
+	const int32_t cycles = gb->cpu.clock - synced;
+	synced = gb->cpu.clock;
+
+	switch (event) {
+	case Event::Ppu:
+		if (gb->ppu.accuracy == PpuAccuracy::Scanline)
+			update_ppu<PpuAccuracy::Scanline>(cycles, gb->memory, gb->sinks, &gb->hwstate, &gb->ppu);
+		else
+			update_ppu<PpuAccuracy::Fifo>(cycles, gb->memory, gb->sinks, &gb->hwstate, &gb->ppu);
+		break;
+	case Event::Timers: update_timers(cycles, &gb->hwstate); break;
+	case Event::Apu: update_apu(cycles, gb->sinks, &gb->apu); break;
+	default: break;
+	}
+
+	schedule_event(event, gb);
+}
+
+
+void schedule_event(const Event event, Gameboy* const gb)
+{
+	// while the lcd or the apu are off they just
+	// wake up now and then to keep 'synced' recent
+	int32_t cycles = 0;
+	switch (event) {
+	case Event::Ppu:
+		if (gb->ppu.lcdc.lcd_on) {
+			cycles = get_ppu_event_cycles(gb->ppu);
+		} else {
+			cycles = get_ppu_mode_clock_limit(PpuMode::VBlank);
+		}
+		break;
+	case Event::Timers:
+		cycles = 256 - gb->hwstate.div_clock;
+		if (test_bit(2, gb->hwstate.tac)) {
+			const int32_t tima_cycles =
+			  gb->hwstate.tima_clock_limit - gb->hwstate.tima_clock;
+			cycles = min(cycles, tima_cycles);
+		}
+		break;
+	case Event::Apu:
+		cycles = gb->apu.power ? gb->apu.frame_cnt : kApuFrameCntTicks;
+		break;
+	default:
+		break;
+	}
+
+	const int32_t synced = gb->sched.synced[static_cast<int>(event)];
+	set_deadline(event, synced + cycles, &gb->sched);
+}
+
+
+// a line in mode 3 as the accuracy changes is finished by the new one:
+// Scanline draws all of it, Fifo ends it where it is
+void set_ppu_accuracy(const PpuAccuracy accuracy, Gameboy* const gb)
+{
+	Ppu* const ppu = &gb->ppu;
+	if (ppu->accuracy == accuracy)
+		return;
+
+	if (accuracy == PpuAccuracy::Fifo)
+		set_ppu_async(false, gb);
+
+	sync_event(Event::Ppu, gb);
+	ppu->accuracy = accuracy;
+	if (accuracy == PpuAccuracy::Fifo) {
+		ppu->line_log.count = 0;
+		ppu->fifo.lx = 160;
+		ppu->fifo.dots = ppu->clock;
+		ppu->fifo.length = get_ppu_mode_clock_limit(PpuMode::Transfer);
+	}
+
+	schedule_event(Event::Ppu, gb);
 }
 
 
-void update_timers(const int16_t cycles, HWState* const hwstate)
+void update_timers(const int32_t cycles, HWState* const hwstate)
 {
 	hwstate->div_clock += cycles;
-	if (hwstate->div_clock >= 256) {
+	while (hwstate->div_clock >= 256) {
 		++hwstate->div;
 		hwstate->div_clock -= 256;
 	}
@@ -59,9 +217,12 @@ void update_interrupts(Gameboy* const gb)
 	const uint8_t pendents = get_pendent_interrupts(gb->hwstate);
 	const auto flags = gb->hwstate.flags;
 
+	// the cycles taken to leave halt and to dispatch
+	// an interrupt aren't seen by the hardware
 	if (pendents && flags.cpu_halt) {
 		gb->hwstate.flags.cpu_halt = false;
 		gb->cpu.clock += 4;
+		shift_events(4, &gb->sched);
 	}
 
 	if (flags.ime == 0) {
@@ -80,6 +241,7 @@ void update_interrupts(Gameboy* const gb)
 			stack_push16(gb->cpu.pc, gb);
 			gb->cpu.pc = interrupt.addr;
 			gb->cpu.clock += 20;
+			shift_events(20, &gb->sched);
 			break;
 		}
 	}
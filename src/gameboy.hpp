@@ -7,6 +7,15 @@
 #include "joypad.hpp"
 #include "hwstate.hpp"
 #include "memory.hpp"
+#include "scheduler.hpp"
+#include "blockcache.hpp"
+#include "jit.hpp"
+#include "idleloop.hpp"
+#include "ppuworker.hpp"
+#include "state.hpp"
+#include "rewind.hpp"
+#include "runahead.hpp"
+#include "sinks.hpp"
 
 namespace gbx {
 
@@ -24,12 +33,88 @@ struct Gameboy {
 	Apu apu;
 	Cpu cpu;
 	Memory memory;
+	PageTable pages;
+	Scheduler sched;
+	BlockCache blkcache;
+	Jit jit;
+	IdleLoops idle;
+	Sinks sinks;
 	Cart cart;
 };
 
-extern Gameboy* create_gameboy(const char* rom_file_path);
+extern Gameboy* create_gameboy(const char* rom_file_path, SavFile sav = SavFile::Use);
 extern void destroy_gameboy(Gameboy* gb);
 extern void run_for(int32_t clock_limit, Gameboy* gb);
+extern void run_events(Gameboy* gb);
+extern void update_interrupts(Gameboy* gb);
+
+// brings the event's hardware up to the current clock and reschedules it
+extern void sync_event(Event event, Gameboy* gb);
+// reschedules the event after a register write changed its timing
+extern void schedule_event(Event event, Gameboy* gb);
+// picks how the ppu emulates mode 3, Scanline unless set.
+// Fifo stops the ppu worker first
+extern void set_ppu_accuracy(PpuAccuracy accuracy, Gameboy* gb);
+// starts or stops a thread drawing the Scanline accuracy's lines from
+// snapshots, while it runs the frame sink is called from that thread.
+// returns false if it couldn't be started
+extern bool set_ppu_async(bool async, Gameboy* gb);
+// waits for the ppu worker to draw and hand over all it was queued
+extern void sync_ppu_worker(Gameboy* gb);
+// the frame being drawn, lines past ly are still the last frame's
+extern const Frame& get_ppu_screen(Gameboy* gb);
+
+
+// runs after every instruction: only due events and pending
+// interrupts ( or an EI about to take effect ) cost a call
+inline void update_hardware(Gameboy* const gb)
+{
+	if (gb->cpu.clock >= gb->sched.next)
+		run_events(gb);
+
+	if (gb->hwstate.flags.ime == 1 || get_pendent_interrupts(gb->hwstate))
+		update_interrupts(gb);
+}
+
+
+inline uint8_t mem_read8(const Gameboy& gb, const uint16_t address)
+{
+	const uint8_t* const page = gb.pages.read[address >> kPageShift];
+	if (page != nullptr)
+		return page[address & kPageMask];
+
+	return mem_read8_slow(gb, address);
+}
+
+
+inline void mem_write8(const uint16_t address, const uint8_t value, Gameboy* const gb)
+{
+	uint8_t* const page = gb->pages.write[address >> kPageShift];
+	if (page != nullptr)
+		page[address & kPageMask] = value;
+	else
+		mem_write8_slow(address, value, gb);
+}
+
+
+inline uint16_t mem_read16(const Gameboy& gb, const uint16_t address)
+{
+	const uint8_t* const page = gb.pages.read[address >> kPageShift];
+	const int offset = address & kPageMask;
+	if (page != nullptr && offset != kPageMask)
+		return concat_bytes(page[offset + 1], page[offset]);
+
+	return concat_bytes(mem_read8(gb, address + 1),
+	                    mem_read8(gb, address));
+}
+
+
+inline void mem_write16(const uint16_t address, const uint16_t value, Gameboy* const gb)
+{
+	mem_write8(address, get_lsb(value), gb);
+	mem_write8(address + 1, get_msb(value), gb);
+}
+
 
 inline void stack_push8(const uint8_t value, Gameboy* const gb)
 {
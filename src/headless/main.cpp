@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include "gameboy.hpp"
+
+
+struct Output {
+	const char* frames_prefix;
+	FILE* audio_file;
+	uint32_t frames;
+	uint32_t samples;
+	std::atomic<bool> failed;
+};
+
+
+static void dump_frame(const gbx::Frame& frame, void* userdata);
+static void dump_audio(const int16_t* samples, int32_t count, void* userdata);
+static bool write_wav_header(uint32_t samples, FILE* file);
+static bool load_state_file(const char* path, gbx::Gameboy* gb);
+static bool save_state_file(const char* path, gbx::Gameboy* gb);
+static void scramble_wram(uint32_t seed, gbx::Gameboy* gb);
+static bool check_rewind(int steps, const uint8_t* states, uint8_t* state,
+                         gbx::Gameboy* gb, gbx::Rewind* rewind);
+
+
+constexpr const int32_t kFrameCycles = 70224;
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s [--frames N] [--dump-frames prefix] "
+		                "[--dump-audio file.wav] [--render-every N] "
+		                "[--jit | --jit-verify] [--no-idle-skip] [--fifo-ppu] [--async-ppu] "
+		                "[--load-state file] [--save-state file] [--rewind seconds] "
+		                "[--rewind-verify bytes] [--run-ahead N] [rom]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char* const rom_path = argv[argc - 1];
+	const char* audio_path = nullptr;
+	const char* load_state_path = nullptr;
+	const char* save_state_path = nullptr;
+	Output output { nullptr, nullptr, 0, 0, { false } };
+	int frames = 3600;
+	int render_every = 1;
+	int rewind_seconds = 0;
+	int rewind_verify = 0;
+	int run_ahead = 0;
+	bool jit = false;
+	bool jit_verify = false;
+	bool idle_skip = true;
+	bool fifo_ppu = false;
+	bool async_ppu = false;
+	for (int i = 1; i < argc - 1; ++i) {
+		const bool has_value = i + 1 < argc - 1;
+		if (strcmp(argv[i], "--frames") == 0 && has_value) {
+			frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--dump-frames") == 0 && has_value) {
+			output.frames_prefix = argv[++i];
+		} else if (strcmp(argv[i], "--dump-audio") == 0 && has_value) {
+			audio_path = argv[++i];
+		} else if (strcmp(argv[i], "--load-state") == 0 && has_value) {
+			load_state_path = argv[++i];
+		} else if (strcmp(argv[i], "--save-state") == 0 && has_value) {
+			save_state_path = argv[++i];
+		} else if (strcmp(argv[i], "--rewind") == 0 && has_value) {
+			rewind_seconds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--rewind-verify") == 0 && has_value) {
+			rewind_verify = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--run-ahead") == 0 && has_value) {
+			run_ahead = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--render-every") == 0 && has_value) {
+			render_every = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--jit") == 0) {
+			jit = true;
+		} else if (strcmp(argv[i], "--jit-verify") == 0) {
+			jit_verify = true;
+		} else if (strcmp(argv[i], "--no-idle-skip") == 0) {
+			idle_skip = false;
+		} else if (strcmp(argv[i], "--fifo-ppu") == 0) {
+			fifo_ppu = true;
+		} else if (strcmp(argv[i], "--async-ppu") == 0) {
+			async_ppu = true;
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (frames <= 0) {
+		fprintf(stderr, "invalid frame count: %d\n", frames);
+		return EXIT_FAILURE;
+	}
+
+	if (rewind_seconds < 0 || rewind_seconds > 3600) {
+		fprintf(stderr, "invalid rewind length: %d\n", rewind_seconds);
+		return EXIT_FAILURE;
+	}
+
+	if (rewind_verify < 0 || (rewind_verify > 0 && rewind_seconds == 0)) {
+		fprintf(stderr, "invalid rewind verify size: %d\n", rewind_verify);
+		return EXIT_FAILURE;
+	}
+
+	// --rewind-verify scrambles wram, taking the two gameboys out of step
+	if (jit_verify && rewind_verify != 0) {
+		fputs("--jit-verify can't be used with --rewind-verify\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (run_ahead < 0 || run_ahead > 8) {
+		fprintf(stderr, "invalid run-ahead frames: %d\n", run_ahead);
+		return EXIT_FAILURE;
+	}
+
+	// 0 keeps the ppu's timing but draws no frame at all
+	if (render_every < 0 || render_every > 255) {
+		fprintf(stderr, "invalid render interval: %d\n", render_every);
+		return EXIT_FAILURE;
+	}
+
+	if (audio_path != nullptr) {
+		output.audio_file = fopen(audio_path, "wb");
+		if (output.audio_file == nullptr) {
+			perror("Couldn't open audio file");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const auto audio_guard = gbx::finally([&output] {
+		if (output.audio_file != nullptr) {
+			if (!write_wav_header(output.samples, output.audio_file))
+				perror("Error while writing audio file");
+			fclose(output.audio_file);
+		}
+	});
+
+	// the header is rewritten with the final size on exit
+	if (output.audio_file != nullptr && !write_wav_header(0, output.audio_file)) {
+		perror("Error while writing audio file");
+		return EXIT_FAILURE;
+	}
+
+	gbx::Gameboy* const gb = gbx::create_gameboy(rom_path);
+
+	if (gb == nullptr)
+		return EXIT_FAILURE;
+
+	const auto gb_guard = gbx::finally([gb] {
+		gbx::destroy_gameboy(gb);
+	});
+
+	if ((jit || jit_verify) && !gbx::set_cpu_backend(gbx::CpuBackend::Jit, gb))
+		return EXIT_FAILURE;
+
+	gb->idle.enabled = idle_skip;
+	if (fifo_ppu)
+		gbx::set_ppu_accuracy(gbx::PpuAccuracy::Fifo, gb);
+	if (async_ppu && !gbx::set_ppu_async(true, gb))
+		return EXIT_FAILURE;
+	if (render_every == 0) {
+		gbx::set_render_policy({ gbx::RenderMode::Never, 0 }, &gb->ppu);
+	} else if (render_every > 1) {
+		const auto interval = static_cast<uint8_t>(render_every);
+		gbx::set_render_policy({ gbx::RenderMode::EveryNth, interval }, &gb->ppu);
+	}
+	if (load_state_path != nullptr && !load_state_file(load_state_path, gb))
+		return EXIT_FAILURE;
+
+	// --jit-verify runs a second gameboy on the interpreter and compares
+	// both after every frame, the run fails on the first mismatch. its
+	// frames aren't drawn, the time it takes is part of the FPS
+	gbx::Gameboy* const ref = jit_verify ? gbx::create_gameboy(rom_path) : nullptr;
+
+	if (jit_verify && ref == nullptr)
+		return EXIT_FAILURE;
+
+	const auto ref_guard = gbx::finally([ref] {
+		if (ref != nullptr)
+			gbx::destroy_gameboy(ref);
+	});
+
+	if (ref != nullptr) {
+		ref->idle.enabled = idle_skip;
+		if (fifo_ppu)
+			gbx::set_ppu_accuracy(gbx::PpuAccuracy::Fifo, ref);
+		gbx::set_render_policy({ gbx::RenderMode::Never, 0 }, &ref->ppu);
+		if (load_state_path != nullptr && !load_state_file(load_state_path, ref))
+			return EXIT_FAILURE;
+	}
+
+	// captured every frame like a frontend would, to time it. --rewind-verify
+	// holds them in that many bytes instead, small enough to wrap around often,
+	// scrambles wram so entries vary in size across the wrap point, keeps a
+	// plain copy of each state and compares them with the states rewound to,
+	// now and then a few and at the end all of them
+	const uint32_t rewind_bytes = rewind_verify > 0 ? rewind_verify
+	  : rewind_seconds * gbx::kRewindBytesPerSecond;
+	gbx::Rewind* const rewind = rewind_seconds == 0 ? nullptr
+	  : gbx::create_rewind(rewind_seconds * 60, rewind_bytes, *gb);
+
+	if (rewind_seconds != 0 && rewind == nullptr)
+		return EXIT_FAILURE;
+
+	const auto rewind_guard = gbx::finally([rewind] {
+		if (rewind != nullptr)
+			gbx::destroy_rewind(rewind);
+	});
+
+	uint8_t* const rewind_states = rewind_verify == 0 ? nullptr
+	  : static_cast<uint8_t*>(malloc((rewind->max_entries + 1) * rewind->state_size));
+
+	if (rewind_verify != 0 && rewind_states == nullptr) {
+		perror("Couldn't allocate memory");
+		return EXIT_FAILURE;
+	}
+
+	const auto rewind_states_guard = gbx::finally([rewind_states] {
+		free(rewind_states);
+	});
+
+	gbx::RunAhead* const ahead = gbx::create_run_ahead(static_cast<uint8_t>(run_ahead), *gb);
+
+	if (ahead == nullptr)
+		return EXIT_FAILURE;
+
+	const auto ahead_guard = gbx::finally([ahead] {
+		gbx::destroy_run_ahead(ahead);
+	});
+
+	gb->sinks.frame = output.frames_prefix != nullptr ? dump_frame : nullptr;
+	gb->sinks.audio = output.audio_file != nullptr ? dump_audio : nullptr;
+	gb->sinks.userdata = &output;
+
+	timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for (int i = 0; i < frames && !output.failed; ++i) {
+		gbx::run_ahead_for(kFrameCycles, ahead, gb);
+		const uint32_t seq = rewind != nullptr ? rewind->first + rewind->count : 0;
+		if (rewind_states != nullptr)
+			scramble_wram(seq, gb);
+		if (rewind != nullptr)
+			gbx::capture_rewind(gb, rewind);
+		if (rewind_states != nullptr) {
+			// a state too big for the data isn't captured. the
+			// last slot is check_rewind's scratch
+			const uint32_t size = rewind->state_size;
+			if (rewind->first + rewind->count == seq + 1)
+				gbx::save_state(gb, &rewind_states[(seq % rewind->max_entries) * size]);
+			if (i % 53 == 52) {
+				uint8_t* const scratch = &rewind_states[rewind->max_entries * size];
+				if (!check_rewind(1 + i / 53 % 11, rewind_states, scratch, gb, rewind))
+					return EXIT_FAILURE;
+			}
+		}
+		if (ref != nullptr) {
+			gbx::run_for(kFrameCycles, ref);
+			if (!gbx::cross_check(*gb, *ref)) {
+				fprintf(stderr, "jit verify: mismatch after frame %d\n", i + 1);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	// the frames still queued to the ppu worker are part of the run
+	gbx::sync_ppu_worker(gb);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	const double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	printf("frames: %d\n"
+	       "seconds: %.3f\n"
+	       "FPS: %.1f\n",
+	       frames, seconds, frames / seconds);
+
+	if (save_state_path != nullptr && !save_state_file(save_state_path, gb))
+		return EXIT_FAILURE;
+
+	if (ref != nullptr)
+		printf("jit verify: %d frames matched\n", frames);
+	if (rewind != nullptr)
+		printf("rewind frames held: %u\n", rewind->count);
+	if (rewind_states != nullptr) {
+		uint8_t* const scratch = &rewind_states[rewind->max_entries * rewind->state_size];
+		if (!check_rewind(static_cast<int>(rewind->count), rewind_states, scratch, gb, rewind))
+			return EXIT_FAILURE;
+	}
+	if (output.frames_prefix != nullptr)
+		printf("frames dumped: %u\n", output.frames);
+	if (output.audio_file != nullptr)
+		printf("samples dumped: %u\n", output.samples);
+	// the loops idle skipping sped up, by pc
+	if (gb->idle.enabled)
+		gbx::print_idle_loops(gb->idle);
+
+	return output.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// each frame goes to its own binary ppm: <prefix>000000.ppm ...
+void dump_frame(const gbx::Frame& frame, void* const userdata)
+{
+	Output* const output = static_cast<Output*>(userdata);
+	if (output->failed)
+		return;
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s%.6u.ppm", output->frames_prefix, output->frames);
+
+	FILE* const file = fopen(path, "wb");
+	if (file == nullptr) {
+		perror("Couldn't open frame file");
+		output->failed = true;
+		return;
+	}
+
+	const auto file_guard = gbx::finally([file] {
+		fclose(file);
+	});
+
+	uint32_t pixels[144 * 160];
+	gbx::convert_frame(frame, gbx::PixelFormat::Argb8888, pixels);
+
+	uint8_t rgb[144 * 160 * 3];
+	for (int i = 0; i < 144 * 160; ++i) {
+		rgb[i * 3 + 0] = (pixels[i] >> 16) & 0xFF;
+		rgb[i * 3 + 1] = (pixels[i] >> 8) & 0xFF;
+		rgb[i * 3 + 2] = pixels[i] & 0xFF;
+	}
+
+	if (fprintf(file, "P6\n160 144\n255\n") < 0 || fwrite(rgb, 1, sizeof(rgb), file) < sizeof(rgb)) {
+		perror("Error while writing frame file");
+		output->failed = true;
+		return;
+	}
+
+	++output->frames;
+}
+
+
+void dump_audio(const int16_t* const samples, const int32_t count, void* const userdata)
+{
+	Output* const output = static_cast<Output*>(userdata);
+	if (output->failed)
+		return;
+
+	if (fwrite(samples, sizeof(int16_t), count, output->audio_file) < static_cast<size_t>(count)) {
+		perror("Error while writing audio file");
+		output->failed = true;
+		return;
+	}
+
+	output->samples += count;
+}
+
+
+// 16 bits mono pcm at the apu's output rate
+bool write_wav_header(const uint32_t samples, FILE* const file)
+{
+	const auto le = [](uint8_t* const dest, const uint32_t value, const int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			dest[i] = (value >> (i * 8)) & 0xFF;
+	};
+
+	const uint32_t data_size = samples * sizeof(int16_t);
+	uint8_t header[44];
+	memcpy(&header[0], "RIFF", 4);
+	le(&header[4], 36 + data_size, 4);
+	memcpy(&header[8], "WAVEfmt ", 8);
+	le(&header[16], 16, 4);
+	le(&header[20], 1, 2);
+	le(&header[22], 1, 2);
+	le(&header[24], gbx::kApuSampleRate, 4);
+	le(&header[28], gbx::kApuSampleRate * sizeof(int16_t), 4);
+	le(&header[32], sizeof(int16_t), 2);
+	le(&header[34], 16, 2);
+	memcpy(&header[36], "data", 4);
+	le(&header[40], data_size, 4);
+
+	const long pos = ftell(file);
+	if (fseek(file, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), file) < sizeof(header))
+		return false;
+
+	return pos <= 0 || fseek(file, pos, SEEK_SET) == 0;
+}
+
+
+bool load_state_file(const char* const path, gbx::Gameboy* const gb)
+{
+	FILE* const file = fopen(path, "rb");
+	if (file == nullptr) {
+		perror("Couldn't open state file");
+		return false;
+	}
+
+	const auto file_guard = gbx::finally([file] {
+		fclose(file);
+	});
+
+	// one byte more than a state of this cart, to tell a bigger file
+	const size_t size = gbx::get_state_size(*gb);
+	uint8_t* const state = static_cast<uint8_t*>(malloc(size + 1));
+	if (state == nullptr) {
+		perror("Couldn't allocate memory");
+		return false;
+	}
+
+	const auto state_guard = gbx::finally([state] {
+		free(state);
+	});
+
+	const size_t read = fread(state, 1, size + 1, file);
+	if (ferror(file)) {
+		perror("Error while reading state file");
+		return false;
+	} else if (!gbx::load_state(state, read, gb)) {
+		fprintf(stderr, "%s isn't a state of this rom\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool save_state_file(const char* const path, gbx::Gameboy* const gb)
+{
+	const size_t size = gbx::get_state_size(*gb);
+	uint8_t* const state = static_cast<uint8_t*>(malloc(size));
+	if (state == nullptr) {
+		perror("Couldn't allocate memory");
+		return false;
+	}
+
+	const auto state_guard = gbx::finally([state] {
+		free(state);
+	});
+
+	gbx::save_state(gb, state);
+
+	FILE* const file = fopen(path, "wb");
+	if (file == nullptr) {
+		perror("Couldn't open state file");
+		return false;
+	}
+
+	const auto file_guard = gbx::finally([file] {
+		fclose(file);
+	});
+
+	if (fwrite(state, 1, size, file) < size) {
+		perror("Error while writing state file");
+		return false;
+	}
+
+	return true;
+}
+
+
+// keyframes are captured with wram zeroed, each state after them has
+// a longer pseudo random run of it filled in, so deltas grow past the
+// size of their keyframe by how far they are from it. the writes go
+// through mem_write8, so code cached from wram is dropped
+void scramble_wram(const uint32_t seed, gbx::Gameboy* const gb)
+{
+	const int size = sizeof(gb->memory.wram);
+	const uint32_t phase = seed % gbx::kRewindKeyframeInterval;
+	const int count = size * phase / gbx::kRewindKeyframeInterval;
+	uint32_t x = seed * 2654435761u + 1;
+	for (int i = 0; i < size; ++i) {
+		x = x * 1103515245u + 12345u;
+		const uint8_t value = i < count ? x >> 16 : 0;
+		gbx::mem_write8(static_cast<uint16_t>(0xC000 + i), value, gb);
+	}
+}
+
+
+// steps back through the newest states held, each has to load
+// the state 'states' holds a plain copy of in its entry's slot
+bool check_rewind(const int steps, const uint8_t* const states, uint8_t* const state,
+                  gbx::Gameboy* const gb, gbx::Rewind* const rewind)
+{
+	const uint32_t size = rewind->state_size;
+	for (int i = 0; i < steps && rewind->count > 0; ++i) {
+		const uint32_t seq = rewind->first + rewind->count - 1;
+		if (!gbx::rewind_frame(gb, rewind)) {
+			fprintf(stderr, "rewind of state %u failed\n", seq);
+			return false;
+		}
+
+		gbx::save_state(gb, state);
+		if (memcmp(state, &states[(seq % rewind->max_entries) * size], size) != 0) {
+			fprintf(stderr, "rewind of state %u loaded a different state\n", seq);
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include "gameboy.hpp"
+#include "idleloop.hpp"
+
+namespace gbx {
+
+static bool is_pure_op(const BlockOp& op, uint16_t address, const Gameboy& gb);
+static bool is_idle_read(uint16_t address);
+static int32_t get_jump_target(const BlockOp& op, uint16_t address, const Gameboy& gb);
+static void report_idle_loop(uint16_t pc, int32_t cycles, IdleLoops* idle);
+
+
+bool is_idle_loop(const Block& block, const Gameboy& gb)
+{
+	uint16_t address = block.pc;
+	for (int i = 0; i < block.nops - 1; ++i) {
+		if (!is_pure_op(block.ops[i], address, gb))
+			return false;
+		address += block.ops[i].length;
+	}
+
+	const BlockOp& last = block.ops[block.nops - 1];
+	return get_jump_target(last, address, gb) == block.pc;
+}
+
+
+void skip_idle_loop(const Block& block, const IdleLoopEntry& entry,
+                    const int32_t clock_limit, Gameboy* const gb)
+{
+	const Cpu& cpu = gb->cpu;
+	const Cpu& prev = entry.cpu;
+	if (cpu.pc != block.pc || cpu.sp != prev.sp || cpu.af != prev.af ||
+	    cpu.bc != prev.bc || cpu.de != prev.de || cpu.hl != prev.hl ||
+	    gb->hwstate.flags.ime != entry.ime)
+		return;
+
+	// an event during the iteration may have changed what it read
+	if (memcmp(gb->sched.deadlines, entry.deadlines, sizeof(entry.deadlines)) != 0)
+		return;
+
+	const int32_t* const deadlines = gb->sched.deadlines;
+	const int32_t target =
+	  min(min(deadlines[static_cast<int>(Event::Ppu)],
+	          deadlines[static_cast<int>(Event::Timers)]), clock_limit);
+	const int32_t cycles = cpu.clock - prev.clock;
+	const int32_t iterations = (target - 1 - cpu.clock) / cycles;
+	if (iterations <= 0)
+		return;
+
+	gb->cpu.clock += iterations * cycles;
+	report_idle_loop(block.pc, iterations * cycles, &gb->idle);
+}
+
+
+void print_idle_loops(const IdleLoops& idle)
+{
+	if (idle.count == 0)
+		return;
+
+	printf("IDLE LOOPS\n");
+	for (int i = 0; i < idle.count; ++i)
+		printf("$%.4X: %u cycles skipped\n", idle.pcs[i], idle.skipped[i]);
+}
+
+
+bool is_pure_op(const BlockOp& op, const uint16_t address, const Gameboy& gb)
+{
+	const uint8_t opcode = op.opcode;
+
+	// LD r, r' and ALU A, r without (HL) and HALT
+	if (opcode >= 0x40 && opcode <= 0xBF)
+		return (opcode & 7) != 6 && (opcode < 0x70 || opcode > 0x77);
+
+	switch (opcode) {
+	// NOP, ADD HL, rr, INC / DEC r and rr, LD r, d8
+	case 0x00: case 0x09: case 0x19: case 0x29: case 0x39:
+	case 0x03: case 0x13: case 0x23: case 0x33:
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+	case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:
+	case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+	// RLCA, RRCA, RLA, RRA, DAA, CPL, SCF, CCF
+	case 0x07: case 0x0F: case 0x17: case 0x1F:
+	case 0x27: case 0x2F: case 0x37: case 0x3F:
+	// ALU A, d8
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+	case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+		return true;
+	// CB ops on registers
+	case 0xCB: return (mem_read8(gb, address + 1) & 7) != 6;
+	// LDH A, (a8) and LD A, (a16)
+	case 0xF0: return is_idle_read(0xFF00 + mem_read8(gb, address + 1));
+	case 0xFA: return is_idle_read(mem_read16(gb, address + 1));
+	default: return false;
+	}
+}
+
+
+bool is_idle_read(const uint16_t address)
+{
+	// the apu registers are the only ones brought
+	// up to date on reads instead of on events
+	return address < 0xFF10 || address > 0xFF3F;
+}
+
+
+int32_t get_jump_target(const BlockOp& op, const uint16_t address, const Gameboy& gb)
+{
+	switch (op.opcode) {
+	// JR
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+		return static_cast<uint16_t>(address + 2 +
+		  static_cast<int8_t>(mem_read8(gb, address + 1)));
+	// JP
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+		return mem_read16(gb, address + 1);
+	default:
+		return -1;
+	}
+}
+
+
+void report_idle_loop(const uint16_t pc, const int32_t cycles, IdleLoops* const idle)
+{
+	for (int i = 0; i < idle->count; ++i) {
+		if (idle->pcs[i] == pc) {
+			idle->skipped[i] += cycles;
+			return;
+		}
+	}
+
+	if (idle->count < kIdleLoopsMaxPcs) {
+		idle->pcs[idle->count] = pc;
+		idle->skipped[idle->count] = cycles;
+		++idle->count;
+	}
+}
+
+
+} // namespace gbx
+
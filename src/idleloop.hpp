@@ -0,0 +1,46 @@
+#ifndef GBX_IDLELOOP_HPP_
+#define GBX_IDLELOOP_HPP_
+#include "common.hpp"
+#include "cpu.hpp"
+#include "scheduler.hpp"
+
+namespace gbx {
+
+struct Block;
+struct Gameboy;
+
+constexpr const int kIdleLoopsMaxPcs = 32;
+
+
+// pcs of the idle loops skipped so far and the cycles skipped at each
+struct IdleLoops {
+	uint16_t pcs[kIdleLoopsMaxPcs];
+	uint32_t skipped[kIdleLoopsMaxPcs];
+	uint8_t count;
+	bool enabled;
+};
+
+// the state an idle loop iteration started from
+struct IdleLoopEntry {
+	Cpu cpu;
+	uint8_t ime;
+	int32_t deadlines[kEventCount];
+};
+
+
+// true if the block jumps back to itself without writing memory or
+// reading anything that can change between scheduled events
+extern bool is_idle_loop(const Block& block, const Gameboy& gb);
+
+// called after an idle loop block ran from 'entry': if the iteration
+// left the cpu as it found it, the following ones would repeat it
+// until the next ppu / timer event, so whole iterations are skipped
+extern void skip_idle_loop(const Block& block, const IdleLoopEntry& entry,
+                           int32_t clock_limit, Gameboy* gb);
+
+extern void print_idle_loops(const IdleLoops& idle);
+
+
+} // namespace gbx
+#endif
+
@@ -2006,15 +2006,7 @@ void prefix_cb(Gameboy* const gb)
 	
 	cb_instructions[cb_op](gb);
 	
-	const uint8_t op_low = cb_op&0x0F;
-	const uint8_t op_high = (cb_op&0xF0)>>4;
-
-	if (op_low != 0x06 && op_low != 0x0E)
-		gb->cpu.clock += 8;
-	else if (op_high < 0x04 || op_high > 0x07)
-		gb->cpu.clock += 16;
-	else
-		gb->cpu.clock += 12;
+	gb->cpu.clock += get_cb_clock(cb_op);
 }
 
 
@@ -2453,6 +2445,343 @@ const uint8_t clock_table[256] {
 };
 
 
+const uint8_t length_table[256] {
+/*     0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F */
+/*0*/  1,  3,  1,  1,  1,  1,  2,  1,  3,  1,  1,  1,  1,  1,  2,  1,
+/*1*/  1,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,
+/*2*/  2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,
+/*3*/  2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,
+/*4*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*5*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*6*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*7*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*8*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*9*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*A*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*B*/  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/*C*/  1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1,
+/*D*/  1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1,
+/*E*/  2,  1,  1,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1,
+/*F*/  2,  1,  1,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1
+};
+
+
+
+#ifdef GBX_THREADED_DISPATCH
+#ifndef __GNUC__
+#error "GBX_THREADED_DISPATCH requires GCC's labels as values"
+#endif
+
+// labels as values version of exec_block: every handler is inlined
+// under its own label, which ends with its own jump to the next op's
+// label instead of returning to a shared indirect call
+void exec_block_threaded(const Block& block, const int32_t clock_limit, Gameboy* const gb)
+{
+	static const void* const labels[256] {
+/*0*/ &&nop_00_op,   &&ld_01_op,    &&ld_02_op,    &&inc_03_op,   &&inc_04_op,   &&dec_05_op,   &&ld_06_op,    &&rlca_07_op,
+      &&ld_08_op,    &&add_09_op,   &&ld_0A_op,    &&dec_0B_op,   &&inc_0C_op,   &&dec_0D_op,   &&ld_0E_op,    &&rrca_0F_op,
+/*1*/ &&stop_10_op,  &&ld_11_op,    &&ld_12_op,    &&inc_13_op,   &&inc_14_op,   &&dec_15_op,   &&ld_16_op,    &&rla_17_op,
+      &&jr_18_op,    &&add_19_op,   &&ld_1A_op,    &&dec_1B_op,   &&inc_1C_op,   &&dec_1D_op,   &&ld_1E_op,    &&rra_1F_op,
+/*2*/ &&jr_20_op,    &&ld_21_op,    &&ld_22_op,    &&inc_23_op,   &&inc_24_op,   &&dec_25_op,   &&ld_26_op,    &&daa_27_op,
+      &&jr_28_op,    &&add_29_op,   &&ld_2A_op,    &&dec_2B_op,   &&inc_2C_op,   &&dec_2D_op,   &&ld_2E_op,    &&cpl_2F_op,
+/*3*/ &&jr_30_op,    &&ld_31_op,    &&ld_32_op,    &&inc_33_op,   &&inc_34_op,   &&dec_35_op,   &&ld_36_op,    &&scf_37_op,
+      &&jr_38_op,    &&add_39_op,   &&ld_3A_op,    &&dec_3B_op,   &&inc_3C_op,   &&dec_3D_op,   &&ld_3E_op,    &&ccf_3F_op,
+/*4*/ &&nop_00_op,   &&ld_41_op,    &&ld_42_op,    &&ld_43_op,    &&ld_44_op,    &&ld_45_op,    &&ld_46_op,    &&ld_47_op,
+      &&ld_48_op,    &&nop_00_op,   &&ld_4A_op,    &&ld_4B_op,    &&ld_4C_op,    &&ld_4D_op,    &&ld_4E_op,    &&ld_4F_op,
+/*5*/ &&ld_50_op,    &&ld_51_op,    &&nop_00_op,   &&ld_53_op,    &&ld_54_op,    &&ld_55_op,    &&ld_56_op,    &&ld_57_op,
+      &&ld_58_op,    &&ld_59_op,    &&ld_5A_op,    &&nop_00_op,   &&ld_5C_op,    &&ld_5D_op,    &&ld_5E_op,    &&ld_5F_op,
+/*6*/ &&ld_60_op,    &&ld_61_op,    &&ld_62_op,    &&ld_63_op,    &&nop_00_op,   &&ld_65_op,    &&ld_66_op,    &&ld_67_op,
+      &&ld_68_op,    &&ld_69_op,    &&ld_6A_op,    &&ld_6B_op,    &&ld_6C_op,    &&nop_00_op,   &&ld_6E_op,    &&ld_6F_op,
+/*7*/ &&ld_70_op,    &&ld_71_op,    &&ld_72_op,    &&ld_73_op,    &&ld_74_op,    &&ld_75_op,    &&halt_76_op,  &&ld_77_op,
+      &&ld_78_op,    &&ld_79_op,    &&ld_7A_op,    &&ld_7B_op,    &&ld_7C_op,    &&ld_7D_op,    &&ld_7E_op,    &&nop_00_op,
+/*8*/ &&add_80_op,   &&add_81_op,   &&add_82_op,   &&add_83_op,   &&add_84_op,   &&add_85_op,   &&add_86_op,   &&add_87_op,
+      &&adc_88_op,   &&adc_89_op,   &&adc_8A_op,   &&adc_8B_op,   &&adc_8C_op,   &&adc_8D_op,   &&adc_8E_op,   &&adc_8F_op,
+/*9*/ &&sub_90_op,   &&sub_91_op,   &&sub_92_op,   &&sub_93_op,   &&sub_94_op,   &&sub_95_op,   &&sub_96_op,   &&sub_97_op,
+      &&sbc_98_op,   &&sbc_99_op,   &&sbc_9A_op,   &&sbc_9B_op,   &&sbc_9C_op,   &&sbc_9D_op,   &&sbc_9E_op,   &&sbc_9F_op,
+/*A*/ &&and_A0_op,   &&and_A1_op,   &&and_A2_op,   &&and_A3_op,   &&and_A4_op,   &&and_A5_op,   &&and_A6_op,   &&and_A7_op,
+      &&xor_A8_op,   &&xor_A9_op,   &&xor_AA_op,   &&xor_AB_op,   &&xor_AC_op,   &&xor_AD_op,   &&xor_AE_op,   &&xor_AF_op,
+/*B*/ &&or_B0_op,    &&or_B1_op,    &&or_B2_op,    &&or_B3_op,    &&or_B4_op,    &&or_B5_op,    &&or_B6_op,    &&or_B7_op,
+      &&cp_B8_op,    &&cp_B9_op,    &&cp_BA_op,    &&cp_BB_op,    &&cp_BC_op,    &&cp_BD_op,    &&cp_BE_op,    &&cp_BF_op,
+/*C*/ &&ret_C0_op,   &&pop_C1_op,   &&jp_C2_op,    &&jp_C3_op,    &&call_C4_op,  &&push_C5_op,  &&add_C6_op,   &&rst_C7_op,
+      &&ret_C8_op,   &&ret_C9_op,   &&jp_CA_op,    &&prefix_cb_op, &&call_CC_op,  &&call_CD_op,  &&adc_CE_op,   &&rst_CF_op,
+/*D*/ &&ret_D0_op,   &&pop_D1_op,   &&jp_D2_op,    &&unknown_op,  &&call_D4_op,  &&push_D5_op,  &&sub_D6_op,   &&rst_D7_op,
+      &&ret_D8_op,   &&reti_D9_op,  &&jp_DA_op,    &&unknown_op,  &&call_DC_op,  &&unknown_op,  &&sbc_DE_op,   &&rst_DF_op,
+/*E*/ &&ldh_E0_op,   &&pop_E1_op,   &&ld_E2_op,    &&unknown_op,  &&unknown_op,  &&push_E5_op,  &&and_E6_op,   &&rst_E7_op,
+      &&add_E8_op,   &&jp_E9_op,    &&ld_EA_op,    &&unknown_op,  &&unknown_op,  &&unknown_op,  &&xor_EE_op,   &&rst_EF_op,
+/*F*/ &&ldh_F0_op,   &&pop_F1_op,   &&ld_F2_op,    &&di_F3_op,    &&unknown_op,  &&push_F5_op,  &&or_F6_op,    &&rst_F7_op,
+      &&ld_F8_op,    &&ld_F9_op,    &&ld_FA_op,    &&ei_FB_op,    &&unknown_op,  &&unknown_op,  &&cp_FE_op,    &&rst_FF_op
+	};
+
+	const bool check_limit = gb->cpu.clock + block.cycles >= clock_limit;
+	const BlockOp* op = &block.ops[0];
+	const BlockOp* const end = op + block.nops;
+	uint16_t next_pc = block.pc;
+
+	gb->blkcache.break_block = false;
+
+#define GBX_DISPATCH_OP()            \
+	next_pc += op->length;       \
+	gb->cpu.pc += op->fetch;     \
+	goto *labels[op->opcode]
+
+#define GBX_NEXT_OP()                                                  \
+	gb->cpu.clock += op->cycles;                                   \
+	update_hardware(gb);                                           \
+	if (gb->cpu.pc != next_pc || gb->blkcache.break_block ||       \
+	    (check_limit && gb->cpu.clock >= clock_limit) || ++op == end) \
+		return;                                                \
+	GBX_DISPATCH_OP()
+
+	GBX_DISPATCH_OP();
+
+// CB ops are pre-decoded to their cb_instructions handler
+prefix_cb_op: op->handler(gb); GBX_NEXT_OP();
+nop_00_op: nop_00(gb); GBX_NEXT_OP();
+ld_01_op: ld_01(gb); GBX_NEXT_OP();
+ld_02_op: ld_02(gb); GBX_NEXT_OP();
+inc_03_op: inc_03(gb); GBX_NEXT_OP();
+inc_04_op: inc_04(gb); GBX_NEXT_OP();
+dec_05_op: dec_05(gb); GBX_NEXT_OP();
+ld_06_op: ld_06(gb); GBX_NEXT_OP();
+rlca_07_op: rlca_07(gb); GBX_NEXT_OP();
+ld_08_op: ld_08(gb); GBX_NEXT_OP();
+add_09_op: add_09(gb); GBX_NEXT_OP();
+ld_0A_op: ld_0A(gb); GBX_NEXT_OP();
+dec_0B_op: dec_0B(gb); GBX_NEXT_OP();
+inc_0C_op: inc_0C(gb); GBX_NEXT_OP();
+dec_0D_op: dec_0D(gb); GBX_NEXT_OP();
+ld_0E_op: ld_0E(gb); GBX_NEXT_OP();
+rrca_0F_op: rrca_0F(gb); GBX_NEXT_OP();
+stop_10_op: stop_10(gb); GBX_NEXT_OP();
+ld_11_op: ld_11(gb); GBX_NEXT_OP();
+ld_12_op: ld_12(gb); GBX_NEXT_OP();
+inc_13_op: inc_13(gb); GBX_NEXT_OP();
+inc_14_op: inc_14(gb); GBX_NEXT_OP();
+dec_15_op: dec_15(gb); GBX_NEXT_OP();
+ld_16_op: ld_16(gb); GBX_NEXT_OP();
+rla_17_op: rla_17(gb); GBX_NEXT_OP();
+jr_18_op: jr_18(gb); GBX_NEXT_OP();
+add_19_op: add_19(gb); GBX_NEXT_OP();
+ld_1A_op: ld_1A(gb); GBX_NEXT_OP();
+dec_1B_op: dec_1B(gb); GBX_NEXT_OP();
+inc_1C_op: inc_1C(gb); GBX_NEXT_OP();
+dec_1D_op: dec_1D(gb); GBX_NEXT_OP();
+ld_1E_op: ld_1E(gb); GBX_NEXT_OP();
+rra_1F_op: rra_1F(gb); GBX_NEXT_OP();
+jr_20_op: jr_20(gb); GBX_NEXT_OP();
+ld_21_op: ld_21(gb); GBX_NEXT_OP();
+ld_22_op: ld_22(gb); GBX_NEXT_OP();
+inc_23_op: inc_23(gb); GBX_NEXT_OP();
+inc_24_op: inc_24(gb); GBX_NEXT_OP();
+dec_25_op: dec_25(gb); GBX_NEXT_OP();
+ld_26_op: ld_26(gb); GBX_NEXT_OP();
+daa_27_op: daa_27(gb); GBX_NEXT_OP();
+jr_28_op: jr_28(gb); GBX_NEXT_OP();
+add_29_op: add_29(gb); GBX_NEXT_OP();
+ld_2A_op: ld_2A(gb); GBX_NEXT_OP();
+dec_2B_op: dec_2B(gb); GBX_NEXT_OP();
+inc_2C_op: inc_2C(gb); GBX_NEXT_OP();
+dec_2D_op: dec_2D(gb); GBX_NEXT_OP();
+ld_2E_op: ld_2E(gb); GBX_NEXT_OP();
+cpl_2F_op: cpl_2F(gb); GBX_NEXT_OP();
+jr_30_op: jr_30(gb); GBX_NEXT_OP();
+ld_31_op: ld_31(gb); GBX_NEXT_OP();
+ld_32_op: ld_32(gb); GBX_NEXT_OP();
+inc_33_op: inc_33(gb); GBX_NEXT_OP();
+inc_34_op: inc_34(gb); GBX_NEXT_OP();
+dec_35_op: dec_35(gb); GBX_NEXT_OP();
+ld_36_op: ld_36(gb); GBX_NEXT_OP();
+scf_37_op: scf_37(gb); GBX_NEXT_OP();
+jr_38_op: jr_38(gb); GBX_NEXT_OP();
+add_39_op: add_39(gb); GBX_NEXT_OP();
+ld_3A_op: ld_3A(gb); GBX_NEXT_OP();
+dec_3B_op: dec_3B(gb); GBX_NEXT_OP();
+inc_3C_op: inc_3C(gb); GBX_NEXT_OP();
+dec_3D_op: dec_3D(gb); GBX_NEXT_OP();
+ld_3E_op: ld_3E(gb); GBX_NEXT_OP();
+ccf_3F_op: ccf_3F(gb); GBX_NEXT_OP();
+ld_41_op: ld_41(gb); GBX_NEXT_OP();
+ld_42_op: ld_42(gb); GBX_NEXT_OP();
+ld_43_op: ld_43(gb); GBX_NEXT_OP();
+ld_44_op: ld_44(gb); GBX_NEXT_OP();
+ld_45_op: ld_45(gb); GBX_NEXT_OP();
+ld_46_op: ld_46(gb); GBX_NEXT_OP();
+ld_47_op: ld_47(gb); GBX_NEXT_OP();
+ld_48_op: ld_48(gb); GBX_NEXT_OP();
+ld_4A_op: ld_4A(gb); GBX_NEXT_OP();
+ld_4B_op: ld_4B(gb); GBX_NEXT_OP();
+ld_4C_op: ld_4C(gb); GBX_NEXT_OP();
+ld_4D_op: ld_4D(gb); GBX_NEXT_OP();
+ld_4E_op: ld_4E(gb); GBX_NEXT_OP();
+ld_4F_op: ld_4F(gb); GBX_NEXT_OP();
+ld_50_op: ld_50(gb); GBX_NEXT_OP();
+ld_51_op: ld_51(gb); GBX_NEXT_OP();
+ld_53_op: ld_53(gb); GBX_NEXT_OP();
+ld_54_op: ld_54(gb); GBX_NEXT_OP();
+ld_55_op: ld_55(gb); GBX_NEXT_OP();
+ld_56_op: ld_56(gb); GBX_NEXT_OP();
+ld_57_op: ld_57(gb); GBX_NEXT_OP();
+ld_58_op: ld_58(gb); GBX_NEXT_OP();
+ld_59_op: ld_59(gb); GBX_NEXT_OP();
+ld_5A_op: ld_5A(gb); GBX_NEXT_OP();
+ld_5C_op: ld_5C(gb); GBX_NEXT_OP();
+ld_5D_op: ld_5D(gb); GBX_NEXT_OP();
+ld_5E_op: ld_5E(gb); GBX_NEXT_OP();
+ld_5F_op: ld_5F(gb); GBX_NEXT_OP();
+ld_60_op: ld_60(gb); GBX_NEXT_OP();
+ld_61_op: ld_61(gb); GBX_NEXT_OP();
+ld_62_op: ld_62(gb); GBX_NEXT_OP();
+ld_63_op: ld_63(gb); GBX_NEXT_OP();
+ld_65_op: ld_65(gb); GBX_NEXT_OP();
+ld_66_op: ld_66(gb); GBX_NEXT_OP();
+ld_67_op: ld_67(gb); GBX_NEXT_OP();
+ld_68_op: ld_68(gb); GBX_NEXT_OP();
+ld_69_op: ld_69(gb); GBX_NEXT_OP();
+ld_6A_op: ld_6A(gb); GBX_NEXT_OP();
+ld_6B_op: ld_6B(gb); GBX_NEXT_OP();
+ld_6C_op: ld_6C(gb); GBX_NEXT_OP();
+ld_6E_op: ld_6E(gb); GBX_NEXT_OP();
+ld_6F_op: ld_6F(gb); GBX_NEXT_OP();
+ld_70_op: ld_70(gb); GBX_NEXT_OP();
+ld_71_op: ld_71(gb); GBX_NEXT_OP();
+ld_72_op: ld_72(gb); GBX_NEXT_OP();
+ld_73_op: ld_73(gb); GBX_NEXT_OP();
+ld_74_op: ld_74(gb); GBX_NEXT_OP();
+ld_75_op: ld_75(gb); GBX_NEXT_OP();
+halt_76_op: halt_76(gb); GBX_NEXT_OP();
+ld_77_op: ld_77(gb); GBX_NEXT_OP();
+ld_78_op: ld_78(gb); GBX_NEXT_OP();
+ld_79_op: ld_79(gb); GBX_NEXT_OP();
+ld_7A_op: ld_7A(gb); GBX_NEXT_OP();
+ld_7B_op: ld_7B(gb); GBX_NEXT_OP();
+ld_7C_op: ld_7C(gb); GBX_NEXT_OP();
+ld_7D_op: ld_7D(gb); GBX_NEXT_OP();
+ld_7E_op: ld_7E(gb); GBX_NEXT_OP();
+add_80_op: add_80(gb); GBX_NEXT_OP();
+add_81_op: add_81(gb); GBX_NEXT_OP();
+add_82_op: add_82(gb); GBX_NEXT_OP();
+add_83_op: add_83(gb); GBX_NEXT_OP();
+add_84_op: add_84(gb); GBX_NEXT_OP();
+add_85_op: add_85(gb); GBX_NEXT_OP();
+add_86_op: add_86(gb); GBX_NEXT_OP();
+add_87_op: add_87(gb); GBX_NEXT_OP();
+adc_88_op: adc_88(gb); GBX_NEXT_OP();
+adc_89_op: adc_89(gb); GBX_NEXT_OP();
+adc_8A_op: adc_8A(gb); GBX_NEXT_OP();
+adc_8B_op: adc_8B(gb); GBX_NEXT_OP();
+adc_8C_op: adc_8C(gb); GBX_NEXT_OP();
+adc_8D_op: adc_8D(gb); GBX_NEXT_OP();
+adc_8E_op: adc_8E(gb); GBX_NEXT_OP();
+adc_8F_op: adc_8F(gb); GBX_NEXT_OP();
+sub_90_op: sub_90(gb); GBX_NEXT_OP();
+sub_91_op: sub_91(gb); GBX_NEXT_OP();
+sub_92_op: sub_92(gb); GBX_NEXT_OP();
+sub_93_op: sub_93(gb); GBX_NEXT_OP();
+sub_94_op: sub_94(gb); GBX_NEXT_OP();
+sub_95_op: sub_95(gb); GBX_NEXT_OP();
+sub_96_op: sub_96(gb); GBX_NEXT_OP();
+sub_97_op: sub_97(gb); GBX_NEXT_OP();
+sbc_98_op: sbc_98(gb); GBX_NEXT_OP();
+sbc_99_op: sbc_99(gb); GBX_NEXT_OP();
+sbc_9A_op: sbc_9A(gb); GBX_NEXT_OP();
+sbc_9B_op: sbc_9B(gb); GBX_NEXT_OP();
+sbc_9C_op: sbc_9C(gb); GBX_NEXT_OP();
+sbc_9D_op: sbc_9D(gb); GBX_NEXT_OP();
+sbc_9E_op: sbc_9E(gb); GBX_NEXT_OP();
+sbc_9F_op: sbc_9F(gb); GBX_NEXT_OP();
+and_A0_op: and_A0(gb); GBX_NEXT_OP();
+and_A1_op: and_A1(gb); GBX_NEXT_OP();
+and_A2_op: and_A2(gb); GBX_NEXT_OP();
+and_A3_op: and_A3(gb); GBX_NEXT_OP();
+and_A4_op: and_A4(gb); GBX_NEXT_OP();
+and_A5_op: and_A5(gb); GBX_NEXT_OP();
+and_A6_op: and_A6(gb); GBX_NEXT_OP();
+and_A7_op: and_A7(gb); GBX_NEXT_OP();
+xor_A8_op: xor_A8(gb); GBX_NEXT_OP();
+xor_A9_op: xor_A9(gb); GBX_NEXT_OP();
+xor_AA_op: xor_AA(gb); GBX_NEXT_OP();
+xor_AB_op: xor_AB(gb); GBX_NEXT_OP();
+xor_AC_op: xor_AC(gb); GBX_NEXT_OP();
+xor_AD_op: xor_AD(gb); GBX_NEXT_OP();
+xor_AE_op: xor_AE(gb); GBX_NEXT_OP();
+xor_AF_op: xor_AF(gb); GBX_NEXT_OP();
+or_B0_op: or_B0(gb); GBX_NEXT_OP();
+or_B1_op: or_B1(gb); GBX_NEXT_OP();
+or_B2_op: or_B2(gb); GBX_NEXT_OP();
+or_B3_op: or_B3(gb); GBX_NEXT_OP();
+or_B4_op: or_B4(gb); GBX_NEXT_OP();
+or_B5_op: or_B5(gb); GBX_NEXT_OP();
+or_B6_op: or_B6(gb); GBX_NEXT_OP();
+or_B7_op: or_B7(gb); GBX_NEXT_OP();
+cp_B8_op: cp_B8(gb); GBX_NEXT_OP();
+cp_B9_op: cp_B9(gb); GBX_NEXT_OP();
+cp_BA_op: cp_BA(gb); GBX_NEXT_OP();
+cp_BB_op: cp_BB(gb); GBX_NEXT_OP();
+cp_BC_op: cp_BC(gb); GBX_NEXT_OP();
+cp_BD_op: cp_BD(gb); GBX_NEXT_OP();
+cp_BE_op: cp_BE(gb); GBX_NEXT_OP();
+cp_BF_op: cp_BF(gb); GBX_NEXT_OP();
+ret_C0_op: ret_C0(gb); GBX_NEXT_OP();
+pop_C1_op: pop_C1(gb); GBX_NEXT_OP();
+jp_C2_op: jp_C2(gb); GBX_NEXT_OP();
+jp_C3_op: jp_C3(gb); GBX_NEXT_OP();
+call_C4_op: call_C4(gb); GBX_NEXT_OP();
+push_C5_op: push_C5(gb); GBX_NEXT_OP();
+add_C6_op: add_C6(gb); GBX_NEXT_OP();
+rst_C7_op: rst_C7(gb); GBX_NEXT_OP();
+ret_C8_op: ret_C8(gb); GBX_NEXT_OP();
+ret_C9_op: ret_C9(gb); GBX_NEXT_OP();
+jp_CA_op: jp_CA(gb); GBX_NEXT_OP();
+call_CC_op: call_CC(gb); GBX_NEXT_OP();
+call_CD_op: call_CD(gb); GBX_NEXT_OP();
+adc_CE_op: adc_CE(gb); GBX_NEXT_OP();
+rst_CF_op: rst_CF(gb); GBX_NEXT_OP();
+ret_D0_op: ret_D0(gb); GBX_NEXT_OP();
+pop_D1_op: pop_D1(gb); GBX_NEXT_OP();
+jp_D2_op: jp_D2(gb); GBX_NEXT_OP();
+unknown_op: unknown(gb); GBX_NEXT_OP();
+call_D4_op: call_D4(gb); GBX_NEXT_OP();
+push_D5_op: push_D5(gb); GBX_NEXT_OP();
+sub_D6_op: sub_D6(gb); GBX_NEXT_OP();
+rst_D7_op: rst_D7(gb); GBX_NEXT_OP();
+ret_D8_op: ret_D8(gb); GBX_NEXT_OP();
+reti_D9_op: reti_D9(gb); GBX_NEXT_OP();
+jp_DA_op: jp_DA(gb); GBX_NEXT_OP();
+call_DC_op: call_DC(gb); GBX_NEXT_OP();
+sbc_DE_op: sbc_DE(gb); GBX_NEXT_OP();
+rst_DF_op: rst_DF(gb); GBX_NEXT_OP();
+ldh_E0_op: ldh_E0(gb); GBX_NEXT_OP();
+pop_E1_op: pop_E1(gb); GBX_NEXT_OP();
+ld_E2_op: ld_E2(gb); GBX_NEXT_OP();
+push_E5_op: push_E5(gb); GBX_NEXT_OP();
+and_E6_op: and_E6(gb); GBX_NEXT_OP();
+rst_E7_op: rst_E7(gb); GBX_NEXT_OP();
+add_E8_op: add_E8(gb); GBX_NEXT_OP();
+jp_E9_op: jp_E9(gb); GBX_NEXT_OP();
+ld_EA_op: ld_EA(gb); GBX_NEXT_OP();
+xor_EE_op: xor_EE(gb); GBX_NEXT_OP();
+rst_EF_op: rst_EF(gb); GBX_NEXT_OP();
+ldh_F0_op: ldh_F0(gb); GBX_NEXT_OP();
+pop_F1_op: pop_F1(gb); GBX_NEXT_OP();
+ld_F2_op: ld_F2(gb); GBX_NEXT_OP();
+di_F3_op: di_F3(gb); GBX_NEXT_OP();
+push_F5_op: push_F5(gb); GBX_NEXT_OP();
+or_F6_op: or_F6(gb); GBX_NEXT_OP();
+rst_F7_op: rst_F7(gb); GBX_NEXT_OP();
+ld_F8_op: ld_F8(gb); GBX_NEXT_OP();
+ld_F9_op: ld_F9(gb); GBX_NEXT_OP();
+ld_FA_op: ld_FA(gb); GBX_NEXT_OP();
+ei_FB_op: ei_FB(gb); GBX_NEXT_OP();
+cp_FE_op: cp_FE(gb); GBX_NEXT_OP();
+rst_FF_op: rst_FF(gb); GBX_NEXT_OP();
+
+#undef GBX_NEXT_OP
+#undef GBX_DISPATCH_OP
+}
+
+#endif
+
+
 
 
 } // namespace gbx
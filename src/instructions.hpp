@@ -7,13 +7,32 @@ namespace gbx {
 
 struct Cpu;
 struct Gameboy;
+struct Block;
 
 using InstructionPtr = void(*)(Gameboy*);
 extern const InstructionPtr main_instructions[256];
 extern const InstructionPtr cb_instructions[256];
 extern const uint8_t clock_table[256];
+extern const uint8_t length_table[256];
+
+#ifdef GBX_THREADED_DISPATCH
+extern void exec_block_threaded(const Block& block, int32_t clock_limit, Gameboy* gb);
+#endif
+
+
+inline uint8_t get_cb_clock(const uint8_t cb_op)
+{
+	const uint8_t op_low = cb_op&0x0F;
+	const uint8_t op_high = (cb_op&0xF0)>>4;
+
+	if (op_low != 0x06 && op_low != 0x0E)
+		return 8;
+	else if (op_high < 0x04 || op_high > 0x07)
+		return 16;
+	else
+		return 12;
+}
 
 
 } // namespace gbx
 #endif
-
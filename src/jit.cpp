@@ -0,0 +1,996 @@
+#include <stdio.h>
+#include <string.h>
+#include <initializer_list>
+#include "debug.hpp"
+#include "gameboy.hpp"
+#include "jit.hpp"
+
+#ifdef GBX_JIT_X64
+#include <sys/mman.h>
+#endif
+
+namespace gbx {
+
+#ifdef GBX_JIT_X64
+
+// x86-64 System V translation of cached blocks.
+//
+// rbx holds the Gameboy pointer and r12d the clock limit, the guest
+// registers are operands on the Cpu struct through rbx. Every op runs
+// exactly as exec_block would run it: the loads and stores, the 8 bit
+// ALU ops, INC / DEC, ADD HL, PUSH / POP, register moves, the CB bit
+// ops on registers and the jumps, calls and returns are emitted inline,
+// other ops are a direct call to their handler. Inline memory accesses
+// go through the page table and only call mem_read8_slow /
+// mem_write8_slow for pages without a host pointer. Cycles are added,
+// update_hardware's checks run inline and the block is left on jumps,
+// interrupts, code changes or when the clock limit is reached, checking
+// only what the op could have changed.
+
+struct Emitter {
+	uint8_t* pos;
+	uint8_t* end;
+	uint8_t* exits[kBlockMaxOps * 5];
+	int nexits;
+	// set once the op being translated may write memory
+	bool may_break;
+};
+
+static void release_code(Gameboy* gb);
+static void flush_natives(Gameboy* gb);
+static void translate(const Block& block, Gameboy* gb, Emitter* e);
+static void emit_update_hardware(const Gameboy& gb, uint16_t next_pc,
+                                 bool check_exit, Emitter* e);
+static bool emit_inline_branch(const Gameboy& gb, uint16_t address,
+                               uint16_t next_pc, const BlockOp& op, Emitter* e);
+static bool emit_inline_op(const Gameboy& gb, uint16_t address,
+                           const BlockOp& op, Emitter* e);
+static void emit_alu(const Gameboy& gb, int alu, Emitter* e);
+static void emit_host_flags(const Gameboy& gb, uint8_t n, bool keep_carry, Emitter* e);
+static void emit_read8(const Gameboy& gb, Emitter* e);
+static void emit_write8(const Gameboy& gb, Emitter* e);
+static void emit_push16(const Gameboy& gb, const uint16_t* pair,
+                        uint16_t value, Emitter* e);
+static void emit_pop16(const Gameboy& gb, int32_t dst_off, uint8_t lsb_mask, Emitter* e);
+static int32_t get_reg_offset(const Gameboy& gb, int reg);
+
+
+bool set_cpu_backend(const CpuBackend backend, Gameboy* const gb)
+{
+	if (backend == CpuBackend::Interpreter) {
+		release_code(gb);
+		return true;
+	}
+
+	if (gb->jit.code == nullptr) {
+		void* const code = mmap(nullptr, kJitCodeSize,
+		                        PROT_READ | PROT_WRITE | PROT_EXEC,
+		                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (code == MAP_FAILED) {
+			perror("Couldn't allocate jit code buffer");
+			return false;
+		}
+
+		gb->jit.code = static_cast<uint8_t*>(code);
+		gb->jit.code_used = 0;
+	}
+
+	gb->jit.enabled = true;
+	return true;
+}
+
+
+bool jit_compile(Block* const block, Gameboy* const gb)
+{
+	if (block->hits < kJitHotBlockHits) {
+		++block->hits;
+		return false;
+	}
+
+	// a translated op takes at most ~330 bytes ( a CALL cc )
+	constexpr const uint32_t max_block_size = kBlockMaxOps * 384 + 64;
+	if (gb->jit.code_used + max_block_size > kJitCodeSize)
+		flush_natives(gb);
+
+	Emitter e;
+	e.pos = gb->jit.code + gb->jit.code_used;
+	e.end = e.pos + max_block_size;
+	e.nexits = 0;
+	e.may_break = false;
+
+	uint8_t* const begin = e.pos;
+	translate(*block, gb, &e);
+
+	gb->jit.code_used += static_cast<uint32_t>(e.pos - begin);
+	block->native = reinterpret_cast<BlockFn>(begin);
+	return true;
+}
+
+
+void release_code(Gameboy* const gb)
+{
+	if (gb->jit.code != nullptr) {
+		flush_natives(gb);
+		munmap(gb->jit.code, kJitCodeSize);
+		gb->jit.code = nullptr;
+	}
+
+	gb->jit.enabled = false;
+}
+
+
+void flush_natives(Gameboy* const gb)
+{
+	for (Block& block : gb->blkcache.blocks) {
+		block.native = nullptr;
+		block.hits = 0;
+	}
+
+	gb->jit.code_used = 0;
+}
+
+
+inline void emit8(const uint8_t byte, Emitter* const e)
+{
+	*e->pos++ = byte;
+}
+
+inline void emit16(const uint16_t value, Emitter* const e)
+{
+	memcpy(e->pos, &value, 2);
+	e->pos += 2;
+}
+
+inline void emit32(const uint32_t value, Emitter* const e)
+{
+	memcpy(e->pos, &value, 4);
+	e->pos += 4;
+}
+
+inline void emit64(const uint64_t value, Emitter* const e)
+{
+	memcpy(e->pos, &value, 8);
+	e->pos += 8;
+}
+
+inline void emit_bytes(std::initializer_list<uint8_t> bytes, Emitter* const e)
+{
+	for (const uint8_t byte : bytes)
+		emit8(byte, e);
+}
+
+inline int32_t get_offset(const Gameboy& gb, const void* const field)
+{
+	return static_cast<int32_t>(static_cast<const uint8_t*>(field) -
+	                            reinterpret_cast<const uint8_t*>(&gb));
+}
+
+inline void emit_call(const void* const func, Emitter* const e)
+{
+	// mov rax, imm64 ; call rax
+	emit_bytes({ 0x48, 0xB8 }, e);
+	emit64(reinterpret_cast<uint64_t>(func), e);
+	emit_bytes({ 0xFF, 0xD0 }, e);
+}
+
+// forward jumps within an op: the rel8 / rel32 to patch is
+// returned and bound once the target is emitted
+inline uint8_t* emit_jump8(const uint8_t opcode, Emitter* const e)
+{
+	emit_bytes({ opcode, 0x00 }, e);
+	return e->pos - 1;
+}
+
+inline void bind_jump8(uint8_t* const rel, Emitter* const e)
+{
+	const auto distance = e->pos - (rel + 1);
+	assert(distance <= 127);
+	*rel = static_cast<uint8_t>(distance);
+}
+
+inline uint8_t* emit_jcc32(const uint8_t cc, Emitter* const e)
+{
+	emit_bytes({ 0x0F, cc }, e);
+	emit32(0, e);
+	return e->pos - 4;
+}
+
+inline void bind_jump32(uint8_t* const rel, Emitter* const e)
+{
+	const auto distance = static_cast<int32_t>(e->pos - (rel + 4));
+	memcpy(rel, &distance, 4);
+}
+
+inline void emit_exit_jcc(const uint8_t cc, Emitter* const e)
+{
+	// jcc rel32, patched to the epilogue
+	e->exits[e->nexits++] = emit_jcc32(cc, e);
+}
+
+inline void emit_store_pc(const int32_t pc_off, const uint16_t pc, Emitter* const e)
+{
+	// mov word [rbx + pc_off], imm16
+	emit_bytes({ 0x66, 0xC7, 0x83 }, e);
+	emit32(pc_off, e);
+	emit16(pc, e);
+}
+
+inline void emit_pc_exit(const int32_t pc_off, const uint16_t next_pc, Emitter* const e)
+{
+	// cmp word [rbx + pc_off], next_pc ; jne exit
+	emit_bytes({ 0x66, 0x81, 0xBB }, e);
+	emit32(pc_off, e);
+	emit16(next_pc, e);
+	emit_exit_jcc(0x85, e);
+}
+
+inline void emit_break_exit(const int32_t break_off, Emitter* const e)
+{
+	// cmp byte [rbx + break_off], 0 ; jne exit
+	emit_bytes({ 0x80, 0xBB }, e);
+	emit32(break_off, e);
+	emit8(0x00, e);
+	emit_exit_jcc(0x85, e);
+}
+
+
+void translate(const Block& block, Gameboy* const gb, Emitter* const e)
+{
+	const Gameboy& cgb = *gb;
+	const int32_t pc_off = get_offset(cgb, &gb->cpu.pc);
+	const int32_t clock_off = get_offset(cgb, &gb->cpu.clock);
+	const int32_t break_off = get_offset(cgb, &gb->blkcache.break_block);
+
+	// push rbx ; push r12 ; push r13 ( keeps calls 16 byte aligned )
+	// mov rbx, rdi ; mov r12d, esi
+	emit_bytes({ 0x53, 0x41, 0x54, 0x41, 0x55 }, e);
+	emit_bytes({ 0x48, 0x89, 0xFB, 0x41, 0x89, 0xF4 }, e);
+
+	// mov byte [rbx + break_off], 0
+	emit_bytes({ 0xC6, 0x83 }, e);
+	emit32(break_off, e);
+	emit8(0x00, e);
+
+	uint16_t address = block.pc;
+	for (int i = 0; i < block.nops; ++i) {
+		const BlockOp& op = block.ops[i];
+		const uint16_t next_pc = address + op.length;
+		const bool last = i == block.nops - 1;
+		bool may_jump = true;
+
+		e->may_break = false;
+		if (emit_inline_branch(cgb, address, next_pc, op, e)) {
+			// pc is set, taken or not
+		} else if (emit_inline_op(cgb, address, op, e)) {
+			emit_store_pc(pc_off, next_pc, e);
+			may_jump = false;
+		} else {
+			emit_store_pc(pc_off, address + op.fetch, e);
+			// mov rdi, rbx ; call handler
+			emit_bytes({ 0x48, 0x89, 0xDF }, e);
+			emit_call(reinterpret_cast<const void*>(op.handler), e);
+			e->may_break = true;
+		}
+
+		// add dword [rbx + clock_off], imm8
+		emit_bytes({ 0x83, 0x83 }, e);
+		emit32(clock_off, e);
+		emit8(op.cycles, e);
+
+		// the block ends after its last op anyway,
+		// the checks there could only leave it earlier
+		emit_update_hardware(cgb, next_pc, !last, e);
+		if (last)
+			break;
+
+		if (may_jump)
+			emit_pc_exit(pc_off, next_pc, e);
+		if (e->may_break)
+			emit_break_exit(break_off, e);
+
+		// cmp dword [rbx + clock_off], r12d ; jge exit
+		emit_bytes({ 0x44, 0x39, 0xA3 }, e);
+		emit32(clock_off, e);
+		emit_exit_jcc(0x8D, e);
+
+		address = next_pc;
+	}
+
+	// epilogue: pop r13 ; pop r12 ; pop rbx ; ret
+	uint8_t* const epilogue = e->pos;
+	emit_bytes({ 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 }, e);
+
+	for (int i = 0; i < e->nexits; ++i) {
+		const auto rel = static_cast<int32_t>(epilogue - (e->exits[i] + 4));
+		memcpy(e->exits[i], &rel, 4);
+	}
+
+	assert(e->pos <= e->end);
+}
+
+
+void emit_update_hardware(const Gameboy& gb, const uint16_t next_pc,
+                          const bool check_exit, Emitter* const e)
+{
+	void (* const events_fn)(Gameboy*) = run_events;
+	void (* const interrupts_fn)(Gameboy*) = update_interrupts;
+
+	// mov eax, [rbx + clock] ; cmp eax, [rbx + sched.next] ; jl skip_events
+	emit_bytes({ 0x8B, 0x83 }, e);
+	emit32(get_offset(gb, &gb.cpu.clock), e);
+	emit_bytes({ 0x3B, 0x83 }, e);
+	emit32(get_offset(gb, &gb.sched.next), e);
+	uint8_t* const skip_events = emit_jump8(0x7C, e);
+	// mov rdi, rbx ; call run_events
+	emit_bytes({ 0x48, 0x89, 0xDF }, e);
+	emit_call(reinterpret_cast<const void*>(events_fn), e);
+	bind_jump8(skip_events, e);
+
+	// movzx eax, byte [rbx + int_enable] ; test al, [rbx + int_flags] ; jnz interrupts
+	emit_bytes({ 0x0F, 0xB6, 0x83 }, e);
+	emit32(get_offset(gb, &gb.hwstate.int_enable), e);
+	emit_bytes({ 0x84, 0x83 }, e);
+	emit32(get_offset(gb, &gb.hwstate.int_flags), e);
+	uint8_t* const interrupts = emit_jump8(0x75, e);
+	// mov al, [rbx + flags] ; and al, 3 ; cmp al, 1 ; jne skip_interrupts
+	// ( ime is the lowest bitfield of hwstate.flags )
+	emit_bytes({ 0x8A, 0x83 }, e);
+	emit32(get_offset(gb, &gb.hwstate.flags), e);
+	emit_bytes({ 0x24, 0x03, 0x3C, 0x01 }, e);
+	uint8_t* const skip_interrupts = emit_jump8(0x75, e);
+	bind_jump8(interrupts, e);
+	// mov rdi, rbx ; call update_interrupts
+	emit_bytes({ 0x48, 0x89, 0xDF }, e);
+	emit_call(reinterpret_cast<const void*>(interrupts_fn), e);
+
+	// a dispatch pushes pc and jumps to its vector
+	if (check_exit) {
+		emit_pc_exit(get_offset(gb, &gb.cpu.pc), next_pc, e);
+		emit_break_exit(get_offset(gb, &gb.blkcache.break_block), e);
+	}
+
+	bind_jump8(skip_interrupts, e);
+}
+
+
+bool emit_inline_branch(const Gameboy& gb, const uint16_t address,
+                        const uint16_t next_pc, const BlockOp& op, Emitter* const e)
+{
+	const uint8_t opcode = op.opcode;
+	const int32_t pc_off = get_offset(gb, &gb.cpu.pc);
+
+	if (opcode == 0xE9) {
+		// JP (HL)
+		// movzx eax, word [rbx + hl] ; mov [rbx + pc], ax
+		emit_bytes({ 0x0F, 0xB7, 0x83 }, e);
+		emit32(get_offset(gb, &gb.cpu.hl), e);
+		emit_bytes({ 0x66, 0x89, 0x83 }, e);
+		emit32(pc_off, e);
+		return true;
+	}
+
+	// JR, JP, CALL and RET, the conditional ones take
+	// NZ Z NC C from opcode bits 3 - 4
+	const bool jr = opcode == 0x18 || (opcode & 0xE7) == 0x20;
+	const bool jp = opcode == 0xC3 || (opcode & 0xE7) == 0xC2;
+	const bool call = opcode == 0xCD || (opcode & 0xE7) == 0xC4;
+	const bool ret = opcode == 0xC9 || (opcode & 0xE7) == 0xC0;
+	if (!jr && !jp && !call && !ret)
+		return false;
+
+	const bool conditional = opcode != 0x18 && opcode != 0xC3 &&
+	                         opcode != 0xCD && opcode != 0xC9;
+	uint8_t* skip = nullptr;
+	if (conditional) {
+		const int cc = (opcode >> 3) & 3;
+		emit_store_pc(pc_off, next_pc, e);
+		// test byte [rbx + f], flag ; jz / jnz skip
+		emit_bytes({ 0xF6, 0x83 }, e);
+		emit32(get_offset(gb, &gb.cpu.f), e);
+		emit8(cc < 2 ? kFlagZ : kFlagC, e);
+		skip = emit_jcc32((cc & 1) ? 0x84 : 0x85, e);
+	}
+
+	if (jr) {
+		emit_store_pc(pc_off, next_pc + static_cast<int8_t>(mem_read8(gb, address + 1)), e);
+	} else if (jp) {
+		emit_store_pc(pc_off, mem_read16(gb, address + 1), e);
+	} else if (call) {
+		emit_push16(gb, nullptr, next_pc, e);
+		emit_store_pc(pc_off, mem_read16(gb, address + 1), e);
+	} else {
+		emit_pop16(gb, pc_off, 0xFF, e);
+	}
+
+	if (conditional) {
+		// the cycles a taken branch adds
+		// add dword [rbx + clock], imm8
+		emit_bytes({ 0x83, 0x83 }, e);
+		emit32(get_offset(gb, &gb.cpu.clock), e);
+		emit8((jr || jp) ? 4 : 12, e);
+		bind_jump32(skip, e);
+	}
+
+	return true;
+}
+
+
+bool emit_inline_op(const Gameboy& gb, const uint16_t address,
+                    const BlockOp& op, Emitter* const e)
+{
+	const uint8_t opcode = op.opcode;
+	const int32_t a_off = get_offset(gb, &gb.cpu.a);
+	const int32_t f_off = get_offset(gb, &gb.cpu.f);
+	const int32_t hl_off = get_offset(gb, &gb.cpu.hl);
+
+	if (opcode == 0x00) {
+		// NOP
+		return true;
+	} else if (opcode >= 0x40 && opcode <= 0x7F) {
+		const int dst = (opcode >> 3) & 7;
+		const int src = opcode & 7;
+		if (dst == 6 && src == 6) {
+			// HALT
+			return false;
+		} else if (src == 6) {
+			// LD r, (HL)
+			// movzx esi, word [rbx + hl] ; read ; mov [rbx + dst], al
+			emit_bytes({ 0x0F, 0xB7, 0xB3 }, e);
+			emit32(hl_off, e);
+			emit_read8(gb, e);
+			emit_bytes({ 0x88, 0x83 }, e);
+			emit32(get_reg_offset(gb, dst), e);
+		} else if (dst == 6) {
+			// LD (HL), r
+			// movzx edi, word [rbx + hl] ; movzx esi, byte [rbx + src] ; write
+			emit_bytes({ 0x0F, 0xB7, 0xBB }, e);
+			emit32(hl_off, e);
+			emit_bytes({ 0x0F, 0xB6, 0xB3 }, e);
+			emit32(get_reg_offset(gb, src), e);
+			emit_write8(gb, e);
+		} else if (dst != src) {
+			// LD r, r'
+			// mov al, [rbx + src] ; mov [rbx + dst], al
+			emit_bytes({ 0x8A, 0x83 }, e);
+			emit32(get_reg_offset(gb, src), e);
+			emit_bytes({ 0x88, 0x83 }, e);
+			emit32(get_reg_offset(gb, dst), e);
+		}
+		return true;
+	} else if (opcode >= 0x80 && opcode <= 0xBF) {
+		// ALU A, r / ALU A, (HL)
+		const int src = opcode & 7;
+		if (src == 6) {
+			// movzx esi, word [rbx + hl] ; read ; mov ecx, eax
+			emit_bytes({ 0x0F, 0xB7, 0xB3 }, e);
+			emit32(hl_off, e);
+			emit_read8(gb, e);
+			emit_bytes({ 0x89, 0xC1 }, e);
+		} else {
+			// mov cl, [rbx + src]
+			emit_bytes({ 0x8A, 0x8B }, e);
+			emit32(get_reg_offset(gb, src), e);
+		}
+		emit_alu(gb, (opcode >> 3) & 7, e);
+		return true;
+	} else if (opcode >= 0xC0 && (opcode & 7) == 6) {
+		// ALU A, d8
+		// mov cl, imm8
+		emit_bytes({ 0xB1, mem_read8(gb, address + 1) }, e);
+		emit_alu(gb, (opcode >> 3) & 7, e);
+		return true;
+	} else if (opcode < 0x40 && (opcode & 7) == 6) {
+		if (opcode == 0x36) {
+			// LD (HL), d8
+			// movzx edi, word [rbx + hl] ; mov esi, imm32 ; write
+			emit_bytes({ 0x0F, 0xB7, 0xBB }, e);
+			emit32(hl_off, e);
+			emit8(0xBE, e);
+			emit32(mem_read8(gb, address + 1), e);
+			emit_write8(gb, e);
+		} else {
+			// LD r, d8
+			// mov byte [rbx + dst], imm8
+			emit_bytes({ 0xC6, 0x83 }, e);
+			emit32(get_reg_offset(gb, opcode >> 3), e);
+			emit8(mem_read8(gb, address + 1), e);
+		}
+		return true;
+	} else if (opcode < 0x40 && (opcode & 6) == 4) {
+		// INC r / DEC r ( Z 0 H - / Z 1 H - )
+		const int reg = opcode >> 3;
+		const bool dec = (opcode & 1) != 0;
+		if (reg == 6) {
+			// INC (HL) / DEC (HL)
+			// movzx esi, word [rbx + hl] ; read ; inc al / dec al
+			emit_bytes({ 0x0F, 0xB7, 0xB3 }, e);
+			emit32(hl_off, e);
+			emit_read8(gb, e);
+			emit_bytes({ 0xFE, static_cast<uint8_t>(dec ? 0xC8 : 0xC0) }, e);
+			emit_host_flags(gb, dec ? kFlagN : 0, true, e);
+			// movzx edi, word [rbx + hl] ; movzx esi, al ; write
+			emit_bytes({ 0x0F, 0xB7, 0xBB }, e);
+			emit32(hl_off, e);
+			emit_bytes({ 0x0F, 0xB6, 0xF0 }, e);
+			emit_write8(gb, e);
+		} else {
+			// inc byte [rbx + r] / dec byte [rbx + r]
+			emit_bytes({ 0xFE, static_cast<uint8_t>(dec ? 0x8B : 0x83) }, e);
+			emit32(get_reg_offset(gb, reg), e);
+			emit_host_flags(gb, dec ? kFlagN : 0, true, e);
+		}
+		return true;
+	}
+
+	const uint16_t* const pairs[4] {
+		&gb.cpu.bc, &gb.cpu.de, &gb.cpu.hl, &gb.cpu.sp
+	};
+
+	const uint16_t* const stack_pairs[4] {
+		&gb.cpu.bc, &gb.cpu.de, &gb.cpu.hl, &gb.cpu.af
+	};
+
+	switch (opcode) {
+	case 0x01: case 0x11: case 0x21: case 0x31:
+		// LD rr, d16
+		// mov word [rbx + rr], imm16
+		emit_bytes({ 0x66, 0xC7, 0x83 }, e);
+		emit32(get_offset(gb, pairs[opcode >> 4]), e);
+		emit16(mem_read16(gb, address + 1), e);
+		return true;
+	case 0x03: case 0x13: case 0x23: case 0x33:
+		// INC rr
+		// inc word [rbx + rr]
+		emit_bytes({ 0x66, 0xFF, 0x83 }, e);
+		emit32(get_offset(gb, pairs[opcode >> 4]), e);
+		return true;
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+		// DEC rr
+		// dec word [rbx + rr]
+		emit_bytes({ 0x66, 0xFF, 0x8B }, e);
+		emit32(get_offset(gb, pairs[opcode >> 4]), e);
+		return true;
+	case 0x09: case 0x19: case 0x29: case 0x39: {
+		// ADD HL, rr ( - 0 H C )
+		const int32_t rr_off = get_offset(gb, pairs[opcode >> 4]);
+		// mov ax, [rbx + hl] ; add al, [rbx + rr] ; adc ah, [rbx + rr + 1]
+		// mov [rbx + hl], ax ( AF is now the carry from bit 11 )
+		emit_bytes({ 0x66, 0x8B, 0x83 }, e);
+		emit32(hl_off, e);
+		emit_bytes({ 0x02, 0x83 }, e);
+		emit32(rr_off, e);
+		emit_bytes({ 0x12, 0xA3 }, e);
+		emit32(rr_off + 1, e);
+		emit_bytes({ 0x66, 0x89, 0x83 }, e);
+		emit32(hl_off, e);
+		// lahf ; movzx ecx, ah ; mov edx, ecx ; and edx, 0x10 ; add edx, edx
+		// and ecx, 1 ; shl ecx, 4 ; or edx, ecx
+		emit_bytes({ 0x9F, 0x0F, 0xB6, 0xCC, 0x89, 0xCA, 0x83, 0xE2, 0x10, 0x01, 0xD2 }, e);
+		emit_bytes({ 0x83, 0xE1, 0x01, 0xC1, 0xE1, 0x04, 0x09, 0xCA }, e);
+		// mov al, [rbx + f] ; and al, kFlagZ ; or al, dl ; mov [rbx + f], al
+		emit_bytes({ 0x8A, 0x83 }, e);
+		emit32(f_off, e);
+		emit_bytes({ 0x24, kFlagZ, 0x08, 0xD0, 0x88, 0x83 }, e);
+		emit32(f_off, e);
+		return true;
+	}
+	case 0x02: case 0x12: case 0x22: case 0x32:
+		// LD (BC), A / LD (DE), A / LD (HL+), A / LD (HL-), A
+		// movzx edi, word [rbx + rr]
+		emit_bytes({ 0x0F, 0xB7, 0xBB }, e);
+		emit32(get_offset(gb, pairs[min(opcode >> 4, 2)]), e);
+		if (opcode >= 0x22) {
+			// inc word [rbx + hl] / dec word [rbx + hl]
+			emit_bytes({ 0x66, 0xFF, static_cast<uint8_t>(opcode == 0x22 ? 0x83 : 0x8B) }, e);
+			emit32(hl_off, e);
+		}
+		// movzx esi, byte [rbx + a] ; write
+		emit_bytes({ 0x0F, 0xB6, 0xB3 }, e);
+		emit32(a_off, e);
+		emit_write8(gb, e);
+		return true;
+	case 0x0A: case 0x1A: case 0x2A: case 0x3A:
+		// LD A, (BC) / LD A, (DE) / LD A, (HL+) / LD A, (HL-)
+		// movzx esi, word [rbx + rr]
+		emit_bytes({ 0x0F, 0xB7, 0xB3 }, e);
+		emit32(get_offset(gb, pairs[min(opcode >> 4, 2)]), e);
+		if (opcode >= 0x2A) {
+			// inc word [rbx + hl] / dec word [rbx + hl]
+			emit_bytes({ 0x66, 0xFF, static_cast<uint8_t>(opcode == 0x2A ? 0x83 : 0x8B) }, e);
+			emit32(hl_off, e);
+		}
+		// read ; mov [rbx + a], al
+		emit_read8(gb, e);
+		emit_bytes({ 0x88, 0x83 }, e);
+		emit32(a_off, e);
+		return true;
+	case 0x2F:
+		// CPL ( - 1 1 - )
+		// not byte [rbx + a] ; or byte [rbx + f], kFlagN | kFlagH
+		emit_bytes({ 0xF6, 0x93 }, e);
+		emit32(a_off, e);
+		emit_bytes({ 0x80, 0x8B }, e);
+		emit32(f_off, e);
+		emit8(kFlagN | kFlagH, e);
+		return true;
+	case 0x37: case 0x3F:
+		// SCF ( - 0 0 1 ) / CCF ( - 0 0 C )
+		// mov al, [rbx + f] ; and al, kFlagZ ; or al, kFlagC
+		// ( CCF: and al, kFlagZ | kFlagC ; xor al, kFlagC ) ; mov [rbx + f], al
+		emit_bytes({ 0x8A, 0x83 }, e);
+		emit32(f_off, e);
+		if (opcode == 0x37)
+			emit_bytes({ 0x24, kFlagZ, 0x0C, kFlagC }, e);
+		else
+			emit_bytes({ 0x24, kFlagZ | kFlagC, 0x34, kFlagC }, e);
+		emit_bytes({ 0x88, 0x83 }, e);
+		emit32(f_off, e);
+		return true;
+	case 0xE0: case 0xE2: case 0xEA:
+		// LDH (a8), A / LD (C), A / LD (a16), A
+		if (opcode == 0xE2) {
+			// movzx edi, byte [rbx + c] ; or edi, 0xFF00
+			emit_bytes({ 0x0F, 0xB6, 0xBB }, e);
+			emit32(get_offset(gb, &gb.cpu.c), e);
+			emit_bytes({ 0x81, 0xCF }, e);
+			emit32(0xFF00, e);
+		} else {
+			// mov edi, imm32
+			emit8(0xBF, e);
+			emit32(opcode == 0xE0 ? 0xFF00 + mem_read8(gb, address + 1)
+			                      : mem_read16(gb, address + 1), e);
+		}
+		// movzx esi, byte [rbx + a] ; write
+		emit_bytes({ 0x0F, 0xB6, 0xB3 }, e);
+		emit32(a_off, e);
+		emit_write8(gb, e);
+		return true;
+	case 0xF0: case 0xF2: case 0xFA:
+		// LDH A, (a8) / LD A, (C) / LD A, (a16)
+		if (opcode == 0xF2) {
+			// movzx esi, byte [rbx + c] ; or esi, 0xFF00
+			emit_bytes({ 0x0F, 0xB6, 0xB3 }, e);
+			emit32(get_offset(gb, &gb.cpu.c), e);
+			emit_bytes({ 0x81, 0xCE }, e);
+			emit32(0xFF00, e);
+		} else {
+			// mov esi, imm32
+			emit8(0xBE, e);
+			emit32(opcode == 0xF0 ? 0xFF00 + mem_read8(gb, address + 1)
+			                      : mem_read16(gb, address + 1), e);
+		}
+		// read ; mov [rbx + a], al
+		emit_read8(gb, e);
+		emit_bytes({ 0x88, 0x83 }, e);
+		emit32(a_off, e);
+		return true;
+	case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+		// POP rr ( POP AF keeps F's low nibble clear )
+		emit_pop16(gb, get_offset(gb, stack_pairs[(opcode >> 4) & 3]),
+		           opcode == 0xF1 ? 0xF0 : 0xFF, e);
+		return true;
+	case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+		// PUSH rr
+		emit_push16(gb, stack_pairs[(opcode >> 4) & 3], 0, e);
+		return true;
+	case 0xCB:
+		break;
+	default:
+		return false;
+	}
+
+	// CB prefixed: BIT, RES and SET on registers
+	const uint8_t cb_op = mem_read8(gb, address + 1);
+	const int reg = cb_op & 7;
+	const uint8_t mask = 0x01 << ((cb_op >> 3) & 7);
+	if (cb_op < 0x40 || reg == 6)
+		return false;
+
+	const int32_t reg_off = get_reg_offset(gb, reg);
+	if (cb_op < 0x80) {
+		// BIT n, r ( Z 0 1 - )
+		// mov al, [rbx + f] ; and al, kFlagC ; or al, kFlagH
+		emit_bytes({ 0x8A, 0x83 }, e);
+		emit32(f_off, e);
+		emit_bytes({ 0x24, kFlagC, 0x0C, kFlagH }, e);
+		// test byte [rbx + r], mask ; jnz +2 ; or al, kFlagZ
+		emit_bytes({ 0xF6, 0x83 }, e);
+		emit32(reg_off, e);
+		emit_bytes({ mask, 0x75, 0x02, 0x0C, kFlagZ }, e);
+		// mov [rbx + f], al
+		emit_bytes({ 0x88, 0x83 }, e);
+		emit32(f_off, e);
+	} else if (cb_op < 0xC0) {
+		// RES n, r
+		// and byte [rbx + r], ~mask
+		emit_bytes({ 0x80, 0xA3 }, e);
+		emit32(reg_off, e);
+		emit8(static_cast<uint8_t>(~mask), e);
+	} else {
+		// SET n, r
+		// or byte [rbx + r], mask
+		emit_bytes({ 0x80, 0x8B }, e);
+		emit32(reg_off, e);
+		emit8(mask, e);
+	}
+
+	return true;
+}
+
+
+// 'alu' is the op in opcode bits 3 - 5: ADD ADC SUB SBC AND XOR OR CP,
+// of A and cl. flags as their handlers set them
+void emit_alu(const Gameboy& gb, const int alu, Emitter* const e)
+{
+	// the host op of each, as 'op al, cl'
+	constexpr const uint8_t host_ops[8] {
+		0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38
+	};
+
+	const int32_t a_off = get_offset(gb, &gb.cpu.a);
+	const int32_t f_off = get_offset(gb, &gb.cpu.f);
+
+	// mov al, [rbx + a]
+	emit_bytes({ 0x8A, 0x83 }, e);
+	emit32(a_off, e);
+	if (alu == 1 || alu == 3) {
+		// ADC / SBC take C as the host carry
+		// mov dl, [rbx + f] ; shr dl, 5
+		emit_bytes({ 0x8A, 0x93 }, e);
+		emit32(f_off, e);
+		emit_bytes({ 0xC0, 0xEA, 0x05 }, e);
+	}
+
+	emit_bytes({ host_ops[alu], 0xC8 }, e);
+
+	if (alu < 4 || alu == 7) {
+		// Z 0 H C / Z 1 H C
+		emit_host_flags(gb, alu >= 2 ? kFlagN : 0, false, e);
+	} else {
+		// AND: Z 0 1 0, XOR / OR: Z 0 0 0
+		// setz dl ; shl dl, 7 ( ; or dl, kFlagH ) ; mov [rbx + f], dl
+		emit_bytes({ 0x0F, 0x94, 0xC2, 0xC0, 0xE2, 0x07 }, e);
+		if (alu == 4)
+			emit_bytes({ 0x80, 0xCA, kFlagH }, e);
+		emit_bytes({ 0x88, 0x93 }, e);
+		emit32(f_off, e);
+	}
+
+	if (alu != 7) {
+		// mov [rbx + a], al
+		emit_bytes({ 0x88, 0x83 }, e);
+		emit32(a_off, e);
+	}
+}
+
+
+// sets f from the host flags of the 8 bit op just emitted: ZF, AF and
+// CF give Z, H and C, 'keep_carry' keeps the old C instead, N is 'n'.
+// al is kept
+void emit_host_flags(const Gameboy& gb, const uint8_t n,
+                     const bool keep_carry, Emitter* const e)
+{
+	const int32_t f_off = get_offset(gb, &gb.cpu.f);
+
+	// lahf ; movzx ecx, ah ; mov edx, ecx ; and edx, 0x50 ; add edx, edx
+	// ( ZF and AF are bits 6 and 4 of ah, one below Z and H )
+	emit_bytes({ 0x9F, 0x0F, 0xB6, 0xCC, 0x89, 0xCA, 0x83, 0xE2, 0x50, 0x01, 0xD2 }, e);
+	if (keep_carry) {
+		// mov cl, [rbx + f] ; and ecx, kFlagC
+		emit_bytes({ 0x8A, 0x8B }, e);
+		emit32(f_off, e);
+		emit_bytes({ 0x83, 0xE1, kFlagC }, e);
+	} else {
+		// and ecx, 1 ; shl ecx, 4 ( CF is bit 0 of ah )
+		emit_bytes({ 0x83, 0xE1, 0x01, 0xC1, 0xE1, 0x04 }, e);
+	}
+
+	// or edx, ecx ( ; or edx, n ) ; mov [rbx + f], dl
+	emit_bytes({ 0x09, 0xCA }, e);
+	if (n != 0)
+		emit_bytes({ 0x83, 0xCA, n }, e);
+	emit_bytes({ 0x88, 0x93 }, e);
+	emit32(f_off, e);
+}
+
+
+// mem_read8 of the address in esi to eax. the caller saved registers
+// are lost to the slow handler's call
+void emit_read8(const Gameboy& gb, Emitter* const e)
+{
+	uint8_t (* const slow_fn)(const Gameboy&, uint16_t) = mem_read8_slow;
+
+	// mov ecx, esi ; shr ecx, kPageShift
+	// mov rdx, [rbx + rcx * 8 + pages.read] ; test rdx, rdx ; jz slow
+	emit_bytes({ 0x89, 0xF1, 0xC1, 0xE9, kPageShift }, e);
+	emit_bytes({ 0x48, 0x8B, 0x94, 0xCB }, e);
+	emit32(get_offset(gb, gb.pages.read), e);
+	emit_bytes({ 0x48, 0x85, 0xD2 }, e);
+	uint8_t* const slow = emit_jump8(0x74, e);
+
+	// and esi, kPageMask ; movzx eax, byte [rdx + rsi] ; jmp done
+	emit_bytes({ 0x81, 0xE6 }, e);
+	emit32(kPageMask, e);
+	emit_bytes({ 0x0F, 0xB6, 0x04, 0x32 }, e);
+	uint8_t* const done = emit_jump8(0xEB, e);
+
+	// slow: mov rdi, rbx ; call mem_read8_slow ; movzx eax, al
+	bind_jump8(slow, e);
+	emit_bytes({ 0x48, 0x89, 0xDF }, e);
+	emit_call(reinterpret_cast<const void*>(slow_fn), e);
+	emit_bytes({ 0x0F, 0xB6, 0xC0 }, e);
+	bind_jump8(done, e);
+}
+
+
+// mem_write8 of sil to the address in edi. the caller saved registers
+// are lost to the slow handler's call
+void emit_write8(const Gameboy& gb, Emitter* const e)
+{
+	void (* const slow_fn)(uint16_t, uint8_t, Gameboy*) = mem_write8_slow;
+
+	// mov ecx, edi ; shr ecx, kPageShift
+	// mov rax, [rbx + rcx * 8 + pages.write] ; test rax, rax ; jz slow
+	emit_bytes({ 0x89, 0xF9, 0xC1, 0xE9, kPageShift }, e);
+	emit_bytes({ 0x48, 0x8B, 0x84, 0xCB }, e);
+	emit32(get_offset(gb, gb.pages.write), e);
+	emit_bytes({ 0x48, 0x85, 0xC0 }, e);
+	uint8_t* const slow = emit_jump8(0x74, e);
+
+	// and edi, kPageMask ; mov [rax + rdi], sil ; jmp done
+	emit_bytes({ 0x81, 0xE7 }, e);
+	emit32(kPageMask, e);
+	emit_bytes({ 0x40, 0x88, 0x34, 0x38 }, e);
+	uint8_t* const done = emit_jump8(0xEB, e);
+
+	// slow: mov rdx, rbx ; call mem_write8_slow
+	bind_jump8(slow, e);
+	emit_bytes({ 0x48, 0x89, 0xDA }, e);
+	emit_call(reinterpret_cast<const void*>(slow_fn), e);
+	bind_jump8(done, e);
+
+	// the slow handlers set break_block on code changes
+	e->may_break = true;
+}
+
+
+// stack_push16 of the register pair at 'pair', or of 'value' without one
+void emit_push16(const Gameboy& gb, const uint16_t* const pair,
+                 const uint16_t value, Emitter* const e)
+{
+	const int32_t sp_off = get_offset(gb, &gb.cpu.sp);
+
+	// sub word [rbx + sp], 2
+	emit_bytes({ 0x66, 0x83, 0xAB }, e);
+	emit32(sp_off, e);
+	emit8(0x02, e);
+
+	// the lsb to sp, the msb to sp + 1
+	for (int i = 0; i < 2; ++i) {
+		// movzx edi, word [rbx + sp] ( ; inc di )
+		emit_bytes({ 0x0F, 0xB7, 0xBB }, e);
+		emit32(sp_off, e);
+		if (i == 1)
+			emit_bytes({ 0x66, 0xFF, 0xC7 }, e);
+
+		if (pair != nullptr) {
+			// movzx esi, byte [rbx + pair + i]
+			emit_bytes({ 0x0F, 0xB6, 0xB3 }, e);
+			emit32(get_offset(gb, pair) + i, e);
+		} else {
+			// mov esi, imm32
+			emit8(0xBE, e);
+			emit32((value >> (i * 8)) & 0xFF, e);
+		}
+
+		emit_write8(gb, e);
+	}
+}
+
+
+// stack_pop16 to the 16 bits at 'dst_off', the lsb masked by 'lsb_mask'
+void emit_pop16(const Gameboy& gb, const int32_t dst_off,
+                const uint8_t lsb_mask, Emitter* const e)
+{
+	const int32_t sp_off = get_offset(gb, &gb.cpu.sp);
+
+	for (int i = 0; i < 2; ++i) {
+		// movzx esi, word [rbx + sp] ( ; inc si ) ; read
+		emit_bytes({ 0x0F, 0xB7, 0xB3 }, e);
+		emit32(sp_off, e);
+		if (i == 1)
+			emit_bytes({ 0x66, 0xFF, 0xC6 }, e);
+		emit_read8(gb, e);
+
+		// ( and al, lsb_mask ; ) mov [rbx + dst + i], al
+		if (i == 0 && lsb_mask != 0xFF)
+			emit_bytes({ 0x24, lsb_mask }, e);
+		emit_bytes({ 0x88, 0x83 }, e);
+		emit32(dst_off + i, e);
+	}
+
+	// add word [rbx + sp], 2
+	emit_bytes({ 0x66, 0x83, 0x83 }, e);
+	emit32(sp_off, e);
+	emit8(0x02, e);
+}
+
+
+int32_t get_reg_offset(const Gameboy& gb, const int reg)
+{
+	// opcode register encoding: B C D E H L (HL) A
+	const uint8_t* const regs[8] {
+		&gb.cpu.b, &gb.cpu.c, &gb.cpu.d, &gb.cpu.e,
+		&gb.cpu.h, &gb.cpu.l, nullptr, &gb.cpu.a
+	};
+
+	return get_offset(gb, regs[reg]);
+}
+
+
+#else
+
+bool set_cpu_backend(const CpuBackend backend, Gameboy* const gb)
+{
+	gb->jit.enabled = false;
+	if (backend == CpuBackend::Jit) {
+		fputs("The jit backend isn't supported on this host\n", stderr);
+		return false;
+	}
+	return true;
+}
+
+
+bool jit_compile(Block* const, Gameboy* const)
+{
+	return false;
+}
+
+#endif
+
+
+bool cross_check(const Gameboy& gb, const Gameboy& ref)
+{
+	const Cpu& c = gb.cpu;
+	const Cpu& r = ref.cpu;
+	if (c.pc != r.pc || c.sp != r.sp || c.af != r.af || c.bc != r.bc ||
+	    c.de != r.de || c.hl != r.hl || c.clock != r.clock) {
+		fprintf(stderr, "CPU MISMATCH\n"
+		        "PC: $%.4X / $%.4X\n"
+		        "SP: $%.4X / $%.4X\n"
+		        "AF: $%.4X / $%.4X\n"
+		        "BC: $%.4X / $%.4X\n"
+		        "DE: $%.4X / $%.4X\n"
+		        "HL: $%.4X / $%.4X\n"
+		        "CLOCK: %d / %d\n",
+		        c.pc, r.pc, c.sp, r.sp, c.af, r.af, c.bc, r.bc,
+		        c.de, r.de, c.hl, r.hl, c.clock, r.clock);
+		return false;
+	}
+
+	const struct {
+		const char* name;
+		const void* data;
+		const void* ref_data;
+		size_t size;
+	} areas[] {
+		{ "HRAM", gb.memory.hram, ref.memory.hram, sizeof(Memory::hram) },
+		{ "WRAM", gb.memory.wram, ref.memory.wram, sizeof(Memory::wram) },
+		{ "VRAM", gb.memory.vram, ref.memory.vram, sizeof(Memory::vram) },
+		{ "OAM", gb.memory.oam, ref.memory.oam, sizeof(Memory::oam) },
+		{ "HWSTATE", &gb.hwstate, &ref.hwstate, sizeof(HWState) }
+	};
+
+	for (const auto& area : areas) {
+		if (memcmp(area.data, area.ref_data, area.size) != 0) {
+			fprintf(stderr, "%s MISMATCH\n", area.name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+} // namespace gbx
+
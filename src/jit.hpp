@@ -0,0 +1,41 @@
+#ifndef GBX_JIT_HPP_
+#define GBX_JIT_HPP_
+#include "common.hpp"
+#include "blockcache.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define GBX_JIT_X64
+#endif
+
+namespace gbx {
+
+constexpr const size_t kJitCodeSize = 4_Mib;
+constexpr const uint8_t kJitHotBlockHits = 8;
+
+enum class CpuBackend : uint8_t {
+	Interpreter,
+	Jit
+};
+
+struct Jit {
+	uint8_t* code;
+	uint32_t code_used;
+	bool enabled;
+};
+
+
+// returns false if the backend isn't available on this host
+extern bool set_cpu_backend(CpuBackend backend, Gameboy* gb);
+
+// counts the block's hits and translates it once it gets hot,
+// returns true if block->native is ready to run
+extern bool jit_compile(Block* block, Gameboy* gb);
+
+// compares the emulated state of a gameboy running the jit
+// against one running the interpreter, printing the first mismatch
+extern bool cross_check(const Gameboy& gb, const Gameboy& ref);
+
+
+} // namespace gbx
+#endif
+
@@ -1,7 +1,6 @@
 #ifndef GBX_JOYPAD_HPP_
 #define GBX_JOYPAD_HPP_
 #include <stdint.h>
-#include "input.hpp"
 #include "hwstate.hpp"
 
 namespace gbx {
@@ -37,6 +36,30 @@ struct Joypad {
 };
 
 
+// the keys P1 reads in its selected mode, bits set for keys up
+inline uint8_t get_joypad_selection(const Joypad& pad)
+{
+	switch (static_cast<JoypadMode>(pad.reg.mode)) {
+	case JoypadMode::Buttons: return pad.keys.buttons;
+	case JoypadMode::Directions: return pad.keys.directions;
+	case JoypadMode::Both: return pad.keys.buttons&pad.keys.directions;
+	default: return 0xF;
+	}
+}
+
+
+// sets the keys held between frames, refreshing P1 and requesting
+// the joypad interrupt if one of the keys it selects goes down
+inline void set_joypad_keys(const uint8_t keys, HWState* const hwstate, Joypad* const pad)
+{
+	const uint8_t old = pad->reg.keys;
+	pad->keys.both = keys;
+	pad->reg.keys = get_joypad_selection(*pad);
+	if ((old & ~pad->reg.keys) != 0)
+		request_interrupt(kInterrupts.joypad, hwstate);
+}
+
+
 inline void update_joypad(const uint32_t(&keycodes)[8],
                           const uint32_t keycode, const KeyState state,
 			  HWState* const /*hwstate*/, Joypad* const pad)
@@ -19,13 +19,13 @@ static uint8_t read_vram(const Memory& mem, uint16_t address);
 static uint8_t read_cart_ram(const Cart& cart, uint16_t address);
 static uint8_t read_io(const Gameboy& gb, uint16_t address);
 
-static void write_cart(uint16_t address, uint8_t value, Cart* cart);
+static void write_cart(uint16_t address, uint8_t value, Gameboy* gb);
 static void write_mbc1(uint16_t address, uint8_t value, Cart* cart);
 static void write_mbc2(uint16_t address, uint8_t value, Cart* cart);
 static void write_hram(uint16_t address, uint8_t value, Gameboy* gb);
-static void write_oam(uint16_t address, uint8_t value, Memory* mem);
-static void write_wram(uint16_t address, uint8_t value, Memory* mem);
-static void write_vram(uint16_t address, uint8_t value, Memory* mem);
+static void write_oam(uint16_t address, uint8_t value, Gameboy* gb);
+static void write_wram(uint16_t address, uint8_t value, Gameboy* gb);
+static void write_vram(uint16_t address, uint8_t value, Gameboy* gb);
 static void write_cart_ram(uint16_t address, uint8_t value, Cart* cart);
 static void write_io(uint16_t address, uint8_t value, Gameboy* gb);
 
@@ -35,9 +35,11 @@ static void write_joypad(uint8_t value, Joypad* keys);
 static void write_div(uint8_t value, HWState* hwstate);
 static void write_tac(uint8_t value, HWState* hwstate);
 static void dma_transfer(uint8_t value, Gameboy* gb);
+static void log_ppu_write(uint16_t address, uint8_t value, Gameboy* gb);
+inline void check_code_write(int_fast32_t mark_offset, Gameboy* gb);
 
 
-uint8_t mem_read8(const Gameboy& gb, const uint16_t address)
+uint8_t mem_read8_slow(const Gameboy& gb, const uint16_t address)
 {
 	if (address < 0x8000)
 		return read_cart(gb.cart, address);
@@ -56,26 +58,75 @@ uint8_t mem_read8(const Gameboy& gb, const uint16_t address)
 }
 
 
-void mem_write8(const uint16_t address, const uint8_t value, Gameboy* const gb)
+void mem_write8_slow(const uint16_t address, const uint8_t value, Gameboy* const gb)
 {
 	if (address >= 0xFF80)
 		write_hram(address, value, gb);
 	else if (address >= 0xFF00)
 		write_io(address, value, gb);
 	else if (address >= 0xFE00)
-		write_oam(address, value, &gb->memory);
+		write_oam(address, value, gb);
 	else if (address >= 0xC000)
-		write_wram(address, value, &gb->memory);
+		write_wram(address, value, gb);
 	else if (address >= 0xA000)
 		write_cart_ram(address, value, &gb->cart);
 	else if (address >= 0x8000)
-		write_vram(address, value, &gb->memory);
+		write_vram(address, value, gb);
 	else
-		write_cart(address, value, &gb->cart);
+		write_cart(address, value, gb);
 }
 
 
 
+void update_page_table(Gameboy* const gb)
+{
+	PageTable& pages = gb->pages;
+	Cart& cart = gb->cart;
+	const int_fast32_t cart_size = cart.info.rom_size() + cart.info.ram_size();
+
+	// pages past the end of the cart data are left to the handlers
+	const auto cart_page = [&cart, cart_size](const int_fast32_t offset) {
+		return offset >= 0 && offset + 0x1000 <= cart_size
+		  ? &cart.data[offset] : nullptr;
+	};
+
+	for (int page = 0x0; page < 0x4; ++page) {
+		pages.read[page] = cart_page(page << kPageShift);
+		pages.write[page] = nullptr;
+	}
+
+	for (int page = 0x4; page < 0x8; ++page) {
+		pages.read[page] = cart_page(cart.rom_bank_offset + (page << kPageShift));
+		pages.write[page] = nullptr;
+	}
+
+	// writes to VRAM must keep the ppu's tile and map caches in sync
+	for (int page = 0x8; page < 0xA; ++page) {
+		pages.read[page] = &gb->memory.vram[(page - 0x8) << kPageShift];
+		pages.write[page] = nullptr;
+	}
+
+	for (int page = 0xA; page < 0xC; ++page) {
+		uint8_t* const ram = cart.ram_enabled
+		  ? cart_page(cart.ram_bank_offset + (page << kPageShift)) : nullptr;
+		pages.read[page] = ram;
+		pages.write[page] = ram;
+	}
+
+	// writes to WRAM pages holding cached code must be checked
+	for (int page = 0xC; page < 0xF; ++page) {
+		const int wram_page = (page - 0xC) & 1;
+		uint8_t* const wram = &gb->memory.wram[wram_page << kPageShift];
+		pages.read[page] = wram;
+		pages.write[page] = (gb->blkcache.code_pages & (1 << wram_page)) ? nullptr : wram;
+	}
+
+	// echo, OAM, IO and HRAM
+	pages.read[0xF] = nullptr;
+	pages.write[0xF] = nullptr;
+}
+
+
 uint8_t read_cart(const Cart& cart, const uint16_t address)
 {
 	const auto offset = eval_cart_rom_offset(cart, address);
@@ -129,15 +180,18 @@ uint8_t read_cart_ram(const Cart& cart, const uint16_t address)
 }
 
 
-void write_cart(const uint16_t address, const uint8_t value, Cart* const cart)
+void write_cart(const uint16_t address, const uint8_t value, Gameboy* const gb)
 {
 	debug_printf("Cartridge ROM: write $%X to $%X\n", value, address);
-	switch (g_cart_info.short_type()) {
-	case CartShortType::RomMBC1: write_mbc1(address, value, cart); break;
-	case CartShortType::RomMBC2: write_mbc2(address, value, cart); break;
+	switch (gb->cart.info.short_type()) {
+	case CartShortType::RomMBC1: write_mbc1(address, value, &gb->cart); break;
+	case CartShortType::RomMBC2: write_mbc2(address, value, &gb->cart); break;
 	default: break;
 	}
 
+	// the bank mapped under a running block may have changed
+	update_page_table(gb);
+	gb->blkcache.break_block = true;
 }
 
 void write_mbc1(const uint16_t address, const uint8_t value, Cart* const cart)
@@ -147,7 +201,7 @@ void write_mbc1(const uint16_t address, const uint8_t value, Cart* const cart)
 		const auto rom_bank_num = 
 		  (mbc1.banking_mode == kRomBankingMode
 		   ? mbc1.banks_num : mbc1.banks_num_lower_bits)
-		   & (g_cart_info.rom_banks() - 1);
+		   & (cart->info.rom_banks() - 1);
 
 		if (rom_bank_num < 0x02) {
 			cart->rom_bank_offset = 0x00;
@@ -162,16 +216,16 @@ void write_mbc1(const uint16_t address, const uint8_t value, Cart* const cart)
 	};
 
 	const auto eval_ram_bank_offset = [cart] {
-		if (g_cart_info.type() < CartType::RomMBC1Ram ||
-		    g_cart_info.ram_banks() < 2 || !cart->ram_enabled)
+		if (cart->info.type() < CartType::RomMBC1Ram ||
+		    cart->info.ram_banks() < 2 || !cart->ram_enabled)
 			return;
 		
 		const auto mbc1 = cart->mbc1;
-		auto offset = g_cart_info.rom_size() - 0xA000;
+		auto offset = cart->info.rom_size() - 0xA000;
 
 		if (mbc1.banking_mode == kRamBankingMode) {
 			const auto bank_num =
-			  mbc1.banks_num_upper_bits&(g_cart_info.ram_banks() - 1);
+			  mbc1.banks_num_upper_bits&(cart->info.ram_banks() - 1);
 
 			offset += 0x2000 * bank_num;
 		}
@@ -202,7 +256,7 @@ void write_mbc1(const uint16_t address, const uint8_t value, Cart* const cart)
 		}
 	} else {
 		const auto new_val = value&0x0F;
-		if (new_val == 0x0A && g_cart_info.ram_banks() && !cart->ram_enabled) {
+		if (new_val == 0x0A && cart->info.ram_banks() && !cart->ram_enabled) {
 			enable_ram(cart);
 			eval_ram_bank_offset();
 		} else if (new_val != 0x0A && cart->ram_enabled) {
@@ -221,7 +275,7 @@ void write_mbc2(const uint16_t address, const uint8_t value, Cart* const cart)
 		const uint8_t new_val = value & 0x0F;
 		if (cart->mbc2.rom_bank_num != new_val) {
 			cart->mbc2.rom_bank_num = new_val;
-			const auto mask = g_cart_info.rom_banks() - 1;
+			const auto mask = cart->info.rom_banks() - 1;
 			const auto bank_num = cart->mbc2.rom_bank_num & mask;
 			cart->rom_bank_offset = bank_num < 0x02 ? 0x00 : (0x4000 * (bank_num - 1));
 		}
@@ -239,31 +293,42 @@ void write_hram(const uint16_t address, const uint8_t value, Gameboy* const gb)
 	if (address != 0xFFFF) {
 		const auto offset = eval_hram_offset(address);
 		gb->memory.hram[offset] = value;
+		check_code_write(kBlockHramMarksOffset + offset, gb);
 	} else {
 		gb->hwstate.int_enable = value&0x1F;
 	}
 }
 
 
-void write_oam(const uint16_t address, const uint8_t value, Memory* const mem)
+void write_oam(const uint16_t address, const uint8_t value, Gameboy* const gb)
 {
 	if (address < 0xFEA0) {
 		const auto offset = eval_oam_offset(address);
-		mem->oam[offset] = value;
+		// only the y and x positions decide the sprite lists
+		if ((offset & 3) < 2 && gb->memory.oam[offset] != value)
+			gb->ppu.sprites.dirty = true;
+		gb->memory.oam[offset] = value;
 	}
 }
 
-void write_wram(const uint16_t address, const uint8_t value, Memory* const mem)
+void write_wram(const uint16_t address, const uint8_t value, Gameboy* const gb)
 {
 	const auto offset = eval_wram_offset(address);
-	mem->wram[offset] = value;
+	gb->memory.wram[offset] = value;
+	check_code_write(offset, gb);
 }
 
 
-void write_vram(const uint16_t address, const uint8_t value, Memory* const mem)
+void write_vram(const uint16_t address, const uint8_t value, Gameboy* const gb)
 {
 	const auto offset = eval_vram_offset(address);
-	mem->vram[offset] = value;
+	if (gb->memory.vram[offset] != value) {
+		// the Fifo accuracy's fetcher reads vram as it draws
+		if (gb->ppu.accuracy == PpuAccuracy::Fifo && get_ppu_mode(gb->ppu) == PpuMode::Transfer)
+			sync_event(Event::Ppu, gb);
+		gb->memory.vram[offset] = value;
+		mark_vram_dirty(offset, &gb->ppu);
+	}
 }
 
 
@@ -280,8 +345,12 @@ uint8_t read_io(const Gameboy& gb, const uint16_t address)
 {
 	debug_printf("Hardware I/O: read $%X\n", address);
 
-	if (address >= 0xFF10 && address <= 0xFF3F)
+	if (address >= 0xFF10 && address <= 0xFF3F) {
+		// NR52 shows the length counters, which run lazily
+		if (address == 0xFF26)
+			sync_event(Event::Apu, const_cast<Gameboy*>(&gb));
 		return read_apu_register(gb.apu, address);
+	}
 
 	switch (address) {
 	case 0xFF00: return gb.joypad.reg.value;
@@ -296,9 +365,9 @@ uint8_t read_io(const Gameboy& gb, const uint16_t address)
 	case 0xFF43: return gb.ppu.scx;
 	case 0xFF44: return gb.ppu.ly;
 	case 0xFF45: return gb.ppu.lyc;
-	case 0xFF47: return gb.ppu.bgp.value;
-	case 0xFF48: return gb.ppu.obp0.value;
-	case 0xFF49: return gb.ppu.obp1.value;
+	case 0xFF47: return gb.ppu.bgp;
+	case 0xFF48: return gb.ppu.obp0;
+	case 0xFF49: return gb.ppu.obp1;
 	case 0xFF4A: return gb.ppu.wy;
 	case 0xFF4B: return gb.ppu.wx;
 	default: break;
@@ -311,30 +380,47 @@ void write_io(const uint16_t address, const uint8_t value, Gameboy* const gb)
 {
 	debug_printf("Hardware I/O: write $%X to $%X\n", value, address);
 
+	// registers changing the timing of the hardware bring it up
+	// to the current clock first and then reschedule its event
 	if (address >= 0xFF10 && address <= 0xFF3F) {
+		sync_event(Event::Apu, gb);
 		write_apu_register(address, value, &gb->apu);
+		schedule_event(Event::Apu, gb);
 		return;
 	}
 
 	switch (address) {
 	case 0xFF00: write_joypad(value, &gb->joypad); break;
-	case 0xFF04: write_div(value, &gb->hwstate); break;
+	case 0xFF04:
+		sync_event(Event::Timers, gb);
+		write_div(value, &gb->hwstate);
+		schedule_event(Event::Timers, gb);
+		break;
 	case 0xFF05: gb->hwstate.tima = value; break;
 	case 0xFF06: gb->hwstate.tma = value; break;
-	case 0xFF07: write_tac(value, &gb->hwstate); break;
+	case 0xFF07:
+		sync_event(Event::Timers, gb);
+		write_tac(value, &gb->hwstate);
+		schedule_event(Event::Timers, gb);
+		break;
 	case 0xFF0F: gb->hwstate.int_flags = value&0x1F; break;
-	case 0xFF40: write_lcdc(value, &gb->ppu, &gb->hwstate); break;
+	case 0xFF40:
+		sync_event(Event::Ppu, gb);
+		log_ppu_write(address, value, gb);
+		write_lcdc(value, &gb->ppu, &gb->hwstate);
+		schedule_event(Event::Ppu, gb);
+		break;
 	case 0xFF41: write_stat(value, &gb->ppu); break;
-	case 0xFF42: gb->ppu.scy = value; break;
-	case 0xFF43: gb->ppu.scx = value; break;
+	case 0xFF42: log_ppu_write(address, value, gb); gb->ppu.scy = value; break;
+	case 0xFF43: log_ppu_write(address, value, gb); gb->ppu.scx = value; break;
 	case 0xFF44: gb->ppu.ly = 0x00; break;
 	case 0xFF45: gb->ppu.lyc = value; break;
 	case 0xFF46: dma_transfer(value, gb); break;
-	case 0xFF47: write_palette(value, &gb->ppu.bgp); break;
-	case 0xFF48: write_palette(value, &gb->ppu.obp0); break;
-	case 0xFF49: write_palette(value, &gb->ppu.obp1); break;
-	case 0xFF4A: gb->ppu.wy = value; break;
-	case 0xFF4B: gb->ppu.wx = value; break;
+	case 0xFF47: log_ppu_write(address, value, gb); gb->ppu.bgp = value; break;
+	case 0xFF48: log_ppu_write(address, value, gb); gb->ppu.obp0 = value; break;
+	case 0xFF49: log_ppu_write(address, value, gb); gb->ppu.obp1 = value; break;
+	case 0xFF4A: log_ppu_write(address, value, gb); gb->ppu.wy = value; break;
+	case 0xFF4B: log_ppu_write(address, value, gb); gb->ppu.wx = value; break;
 	default: break;
 	}
 }
@@ -343,11 +429,18 @@ void write_io(const uint16_t address, const uint8_t value, Gameboy* const gb)
 void write_lcdc(const uint8_t value, Ppu* const ppu, HWState* const hwstate)
 {
 	const auto old_lcd_off = !ppu->lcdc.lcd_on;
+	const auto old_obj_size = ppu->lcdc.obj_size;
 	ppu->lcdc.value = value;
+	if (ppu->lcdc.obj_size != old_obj_size)
+		ppu->sprites.dirty = true;
+
 	const auto new_lcd_off = !ppu->lcdc.lcd_on;
 	if (new_lcd_off) {
 		ppu->clock = 0;
 		ppu->ly = 0;
+		ppu->line_log.count = 0;
+		ppu->fifo.win_line = 0;
+		ppu->fifo.wy_hit = false;
 		set_ppu_mode(PpuMode::HBlank, ppu, hwstate);
 	} else if (old_lcd_off) {
 		set_ppu_mode(PpuMode::SearchOAM, ppu, hwstate);
@@ -363,15 +456,7 @@ void write_stat(const uint8_t value, Ppu* const ppu)
 void write_joypad(const uint8_t value, Joypad* const pad)
 {
 	pad->reg.value = (pad->reg.value&0xCF) | (value&0x30);
-	const auto buttons = pad->keys.buttons;
-	const auto directions = pad->keys.directions;
-
-	switch (static_cast<JoypadMode>(pad->reg.mode)) {
-	case JoypadMode::Buttons: pad->reg.keys = buttons; break;
-	case JoypadMode::Directions: pad->reg.keys = directions; break;
-	case JoypadMode::Both: pad->reg.keys = buttons&directions; break;
-	default: pad->reg.keys = 0xF; break;
-	}
+	pad->reg.keys = get_joypad_selection(*pad);
 }
 
 
@@ -390,6 +475,13 @@ void write_div(const uint8_t /*value*/, HWState* const hwstate)
 
 
 
+void check_code_write(const int_fast32_t mark_offset, Gameboy* const gb)
+{
+	if (gb->blkcache.code_marks[mark_offset])
+		invalidate_ram_blocks(gb);
+}
+
+
 void dma_transfer(const uint8_t value, Gameboy* const gb)
 {
 	constexpr const auto nbytes = sizeof(Memory::oam);
@@ -409,6 +501,24 @@ void dma_transfer(const uint8_t value, Gameboy* const gb)
 		for (auto& byte : gb->memory.oam)
 			byte = mem_read8(*gb, addr++);
 	}
+
+	gb->ppu.sprites.dirty = true;
+}
+
+
+// the ppu is only brought up to date at its mode changes, how far
+// into the current mode the write lands is the cycles since then.
+// the Fifo accuracy reads the registers as it draws, it is brought
+// up to the write instead
+void log_ppu_write(const uint16_t address, const uint8_t value, Gameboy* const gb)
+{
+	if (gb->ppu.accuracy == PpuAccuracy::Fifo) {
+		sync_event(Event::Ppu, gb);
+		return;
+	}
+
+	const int32_t since_sync = gb->cpu.clock - gb->sched.synced[static_cast<int>(Event::Ppu)];
+	log_line_write(gb->ppu.clock + since_sync, address, value, &gb->ppu);
 }
 
 
@@ -419,7 +529,7 @@ int_fast32_t eval_cart_rom_offset(const Cart& cart, const uint16_t address)
 	
 	const auto offset = address < 0x4000 ? address : cart.rom_bank_offset + address;
 
-	assert(offset >= 0 && address < g_cart_info.rom_size());
+	assert(offset >= 0 && address < cart.info.rom_size());
 	return offset;
 }
 
@@ -429,7 +539,7 @@ int_fast32_t eval_cart_ram_offset(const Cart& cart, const uint16_t address)
 
 	const int_fast32_t offset = cart.ram_bank_offset + address;
 	
-	assert(offset >= 0 && static_cast<uint_fast32_t>(offset) < (g_cart_info.rom_size() + g_cart_info.ram_size()));
+	assert(offset >= 0 && static_cast<uint_fast32_t>(offset) < (cart.info.rom_size() + cart.info.ram_size()));
 
 	return offset;
 }
@@ -6,6 +6,11 @@ namespace gbx {
 
 struct Gameboy;
 
+constexpr const int kPageShift = 12;
+constexpr const int kPageMask = 0x0FFF;
+constexpr const int kPageCount = 0x10000 >> kPageShift;
+
+
 struct Memory {
 	uint8_t hram[127];
 	uint8_t wram[8_Kib];
@@ -13,22 +18,29 @@ struct Memory {
 	uint8_t oam[160];
 };
 
-extern uint8_t mem_read8(const Gameboy& gb, uint16_t address);
-extern void mem_write8(uint16_t address, uint8_t value, Gameboy* gb);
+// host pointers to each 4 KiB page of the address space, nullptr
+// where accesses must go through the handlers ( MBC registers, IO,
+// OAM, disabled cart RAM and WRAM pages holding cached code )
+struct PageTable {
+	const uint8_t* read[kPageCount];
+	uint8_t* write[kPageCount];
+};
+
+
+// mem_read8 / mem_write8 / mem_read16 / mem_write16 are
+// defined in gameboy.hpp, where the page table is reachable
+inline uint8_t mem_read8(const Gameboy& gb, uint16_t address);
+inline void mem_write8(uint16_t address, uint8_t value, Gameboy* gb);
+inline uint16_t mem_read16(const Gameboy& gb, uint16_t address);
+inline void mem_write16(uint16_t address, uint16_t value, Gameboy* gb);
 
-inline uint16_t mem_read16(const Gameboy& gb, const uint16_t address)
-{
-	return concat_bytes(mem_read8(gb, address + 1),
-                             mem_read8(gb, address));
-}
+extern uint8_t mem_read8_slow(const Gameboy& gb, uint16_t address);
+extern void mem_write8_slow(uint16_t address, uint8_t value, Gameboy* gb);
 
-inline void mem_write16(const uint16_t address, const uint16_t value, Gameboy* const gb)
-{
-	mem_write8(address, get_lsb(value), gb);
-	mem_write8(address + 1, get_msb(value), gb);
-}
+// rebuilds the page table after a bank switch, a cart RAM
+// enable / disable or a change in the WRAM pages holding code
+extern void update_page_table(Gameboy* gb);
 
 
 } // namespace gbx
 #endif
-
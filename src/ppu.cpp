@@ -1,53 +1,95 @@
 #include <string.h>
 #include <stdlib.h>
-#include "video.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "debug.hpp"
 #include "gameboy.hpp"
 
 
 namespace gbx {
 
-struct Scanline {
-	uint32_t* data;
-	const Color(&colors)[4];
-};
 
-uint32_t Ppu::screen[144][160];
-
-
-void update_ppu(int16_t cycles, const Memory& mem, HWState* hwstate, Ppu* ppu);
+template<PpuAccuracy accuracy>
+void update_ppu(int32_t cycles, const Memory& mem, const Sinks& sinks, HWState* hwstate, Ppu* ppu);
 inline void mode_hblank(Ppu* ppu, HWState* hwstate);
-inline void mode_vblank(Ppu* ppu, HWState* hwstate);
+inline void mode_vblank(const Sinks& sinks, Ppu* ppu, HWState* hwstate);
 inline void mode_oam(Ppu* ppu, HWState* hwstate);
 inline void mode_transfer(const Memory& mem, Ppu* ppu, HWState* hwstate);
+inline int16_t get_fifo_mode_clock_limit(PpuMode mode, const Ppu& ppu);
+static void start_pixel_fifo(const Memory& mem, Ppu* ppu, HWState* hwstate);
+static bool run_pixel_fifo(const Memory& mem, Ppu* ppu);
+static void end_pixel_fifo(Ppu* ppu, HWState* hwstate);
+static void step_pixel_fifo(const Memory& mem, Ppu* ppu);
+static bool step_fifo_sprite(const Memory& mem, Ppu* ppu);
+static void step_fifo_fetcher(const Memory& mem, Ppu* ppu);
+static void merge_fifo_sprite(const Memory& mem, int oam_offset, Ppu* ppu);
 inline void check_ppu_lyc(Ppu* ppu, HWState* hwstate);
-static void update_bg_scanline(const Memory& mem, Ppu* ppu);
-static void update_win_scanline(const Memory& mem, Ppu* ppu);
+static void start_frame(Ppu* ppu);
+static void update_tile_cache(const Memory& mem, Ppu* ppu);
+static void decode_tile(const uint8_t* data, int tile, TileCache* tiles);
+static const MapCache& update_map_cache(const Memory& mem, int map_index, Ppu* ppu);
+static void draw_logged_line(const Memory& mem, Ppu* ppu);
+static void write_line_register(const LineWrite& write, LineRegisters* regs);
+static void record_palettes(int x, Ppu* ppu);
+static void update_bg_scanline(const Memory& mem, int xbeg, int xend, Ppu* ppu);
+static void update_win_scanline(const Memory& mem, int xbeg, int xend, Ppu* ppu);
+static void update_sprite_lists(const Memory& mem, Ppu* ppu);
 static void update_sprite_scanline(const Memory& mem, Ppu* ppu);
-static void fill_scanline(int pbeg, int pend, uint16_t row, Scanline* scanline);
+static void blend_sprite_row(const uint8_t* row, uint8_t palette, bool behind_bg,
+                             uint8_t* claimed, uint8_t* dest);
+inline int get_bg_tile(uint8_t id, bool unsig_data);
 
 
-void update_ppu(const int16_t cycles, const Memory& mem, HWState* const hwstate, Ppu* const ppu)
+// both accuracies share the mode machine, Fifo runs its mode 3 up to
+// the clock and leaves it once the line is out
+template<PpuAccuracy accuracy>
+void update_ppu(const int32_t cycles, const Memory& mem, const Sinks& sinks,
+                HWState* const hwstate, Ppu* const ppu)
 {
+	constexpr const bool fifo = accuracy == PpuAccuracy::Fifo;
+
 	if (!ppu->lcdc.lcd_on)
 		return;
 
-	const auto mode = get_ppu_mode(*ppu);
-	const auto clock_limit = get_ppu_mode_clock_limit(mode);
 	ppu->clock += cycles;
 
-	if (ppu->clock >= clock_limit) {
+	for (;;) {
+		const auto mode = get_ppu_mode(*ppu);
+		if (fifo && mode == PpuMode::Transfer) {
+			if (!run_pixel_fifo(mem, ppu))
+				break;
+			ppu->clock -= ppu->fifo.length;
+			end_pixel_fifo(ppu, hwstate);
+			continue;
+		}
+
+		const auto clock_limit = fifo ? get_fifo_mode_clock_limit(mode, *ppu)
+		                              : get_ppu_mode_clock_limit(mode);
+		if (ppu->clock < clock_limit)
+			break;
+
 		ppu->clock -= clock_limit;
 		switch (mode) {
 		case PpuMode::HBlank: mode_hblank(ppu, hwstate); break;
-		case PpuMode::VBlank: mode_vblank(ppu, hwstate); break;
-		case PpuMode::SearchOAM: mode_oam(ppu, hwstate); break;
+		case PpuMode::VBlank: mode_vblank(sinks, ppu, hwstate); break;
+		case PpuMode::SearchOAM:
+			if (fifo)
+				start_pixel_fifo(mem, ppu, hwstate);
+			else
+				mode_oam(ppu, hwstate);
+			break;
 		case PpuMode::Transfer: mode_transfer(mem, ppu, hwstate); break;
 		default: break;
 		}
 	}
 }
 
+template void update_ppu<PpuAccuracy::Scanline>(int32_t, const Memory&, const Sinks&,
+                                                HWState*, Ppu*);
+template void update_ppu<PpuAccuracy::Fifo>(int32_t, const Memory&, const Sinks&,
+                                            HWState*, Ppu*);
+
 
 void mode_hblank(Ppu* const ppu, HWState* const hwstate)
 {
@@ -61,11 +103,19 @@ void mode_hblank(Ppu* const ppu, HWState* const hwstate)
 }
 
 
-void mode_vblank(Ppu* const ppu, HWState* const hwstate)
+void mode_vblank(const Sinks& sinks, Ppu* const ppu, HWState* const hwstate)
 {
 	if (++ppu->ly > 153) {
 		ppu->ly = 0;
-		render_graphics(&ppu->screen[0][0], sizeof(ppu->screen));
+		if (!ppu->skip_frame) {
+			if (ppu->worker != nullptr)
+				queue_ppu_frame(sinks, ppu);
+			else if (sinks.frame != nullptr)
+				sinks.frame(ppu->screen, sinks.userdata);
+			if (ppu->render.mode == RenderMode::NextFrame)
+				ppu->render.mode = RenderMode::Never;
+		}
+		start_frame(ppu);
 		set_ppu_mode(PpuMode::SearchOAM, ppu, hwstate);
 	}
 	check_ppu_lyc(ppu, hwstate);
@@ -80,13 +130,39 @@ void mode_oam(Ppu* const ppu, HWState* const hwstate)
 
 void mode_transfer(const Memory& mem, Ppu* const ppu, HWState* const hwstate)
 {
-	update_bg_scanline(mem, ppu);
-	update_win_scanline(mem, ppu);
-	update_sprite_scanline(mem, ppu);
+	if (!ppu->skip_frame) {
+		if (ppu->worker != nullptr)
+			queue_ppu_line(mem, ppu);
+		else
+			draw_scanline(mem, ppu);
+	} else {
+		// writes logged before the frame got skipped would
+		// split the first line drawn on a later frame
+		ppu->line_log.count = 0;
+	}
 	set_ppu_mode(PpuMode::HBlank, ppu, hwstate);
 }
 
 
+void draw_scanline(const Memory& mem, Ppu* const ppu)
+{
+	update_tile_cache(mem, ppu);
+	if (ppu->line_log.count == 0) {
+		uint8_t* const palettes = ppu->screen.palettes[ppu->ly];
+		palettes[kPaletteBgp] = ppu->bgp;
+		palettes[kPaletteObp0] = ppu->obp0;
+		palettes[kPaletteObp1] = ppu->obp1;
+		ppu->screen.split_counts[ppu->ly] = 0;
+		update_bg_scanline(mem, 0, 160, ppu);
+		update_win_scanline(mem, 0, 160, ppu);
+	} else {
+		draw_logged_line(mem, ppu);
+		ppu->line_log.count = 0;
+	}
+	update_sprite_scanline(mem, ppu);
+}
+
+
 void check_ppu_lyc(Ppu* const ppu, HWState* const hwstate)
 {
 	if (ppu->ly != ppu->lyc) {
@@ -100,204 +176,582 @@ void check_ppu_lyc(Ppu* const ppu, HWState* const hwstate)
 }
 
 
-void update_bg_scanline(const Memory& mem, Ppu* const ppu)
+int16_t get_fifo_mode_clock_limit(const PpuMode mode, const Ppu& ppu)
+{
+	return mode == PpuMode::HBlank ? 376 - ppu.fifo.length : get_ppu_mode_clock_limit(mode);
+}
+
+
+// mode 3 starts with a fetch that is thrown away, then the
+// first SCX % 8 pixels shifted out are dropped as well
+void start_pixel_fifo(const Memory& mem, Ppu* const ppu, HWState* const hwstate)
+{
+	PixelFifo& fifo = ppu->fifo;
+	fifo.bg_count = 0;
+	fifo.obj_head = 0;
+	fifo.obj_count = 0;
+	fifo.fetch_dots = 0;
+	fifo.fetch_x = 0;
+	fifo.lx = 0;
+	fifo.discard = ppu->scx & 7;
+	fifo.warmup = 6;
+	fifo.next_sprite = 0;
+	fifo.sprite_dots = 0;
+	fifo.in_window = false;
+	fifo.wy_hit = fifo.wy_hit || ppu->ly == ppu->wy;
+	fifo.dots = 0;
+
+	if (ppu->sprites.dirty)
+		update_sprite_lists(mem, ppu);
+
+	if (!ppu->skip_frame) {
+		uint8_t* const palettes = ppu->screen.palettes[ppu->ly];
+		palettes[kPaletteBgp] = ppu->bgp;
+		palettes[kPaletteObp0] = ppu->obp0;
+		palettes[kPaletteObp1] = ppu->obp1;
+		ppu->screen.split_counts[ppu->ly] = 0;
+	}
+
+	set_ppu_mode(PpuMode::Transfer, ppu, hwstate);
+}
+
+
+// runs the dots the clock is ahead by, true once the line is out.
+// palette writes bring the ppu up to them before they are stored,
+// so the ones made since the last run show from the current pixel
+bool run_pixel_fifo(const Memory& mem, Ppu* const ppu)
 {
+	PixelFifo& fifo = ppu->fifo;
+	if (!ppu->skip_frame && fifo.lx < 160)
+		record_palettes(fifo.lx, ppu);
+
+	while (fifo.lx < 160) {
+		if (fifo.dots >= ppu->clock)
+			return false;
+		step_pixel_fifo(mem, ppu);
+		++fifo.dots;
+	}
+
+	fifo.length = fifo.dots;
+	return true;
+}
+
+
+void end_pixel_fifo(Ppu* const ppu, HWState* const hwstate)
+{
+	if (ppu->fifo.in_window)
+		++ppu->fifo.win_line;
+	set_ppu_mode(PpuMode::HBlank, ppu, hwstate);
+}
+
+
+// one dot: the window restarts the fetcher when reached, a due sprite
+// stalls the output while it is fetched, else the fetcher moves on
+// and a pixel is shifted out if there is any
+void step_pixel_fifo(const Memory& mem, Ppu* const ppu)
+{
+	PixelFifo& fifo = ppu->fifo;
+	if (fifo.warmup > 0) {
+		--fifo.warmup;
+		return;
+	}
+
 	const auto lcdc = ppu->lcdc;
+	if (!fifo.in_window && lcdc.win_on && fifo.wy_hit && fifo.lx + 7 >= ppu->wx) {
+		fifo.in_window = true;
+		fifo.bg_count = 0;
+		fifo.fetch_dots = 0;
+		fifo.fetch_x = 0;
+		// a wx under 7 hides the window's first pixels
+		if (fifo.lx == 0)
+			fifo.discard = 7 - ppu->wx;
+	}
+
+	if (step_fifo_sprite(mem, ppu))
+		return;
+
+	step_fifo_fetcher(mem, ppu);
+	if (fifo.bg_count == 0)
+		return;
+
+	const uint8_t colnum = fifo.bg[8 - fifo.bg_count--];
+	if (fifo.discard > 0) {
+		--fifo.discard;
+		return;
+	}
+
+	uint8_t pixel = lcdc.bg_on ? colnum : kPaletteBlank << 2;
+	if (fifo.obj_count > 0) {
+		const uint8_t obj = fifo.obj[fifo.obj_head];
+		fifo.obj_head = (fifo.obj_head + 1) & 7;
+		--fifo.obj_count;
+		if ((obj & 3) != 0 && lcdc.obj_on && (!(obj & 0x80) || get_pixel_color_number(pixel) == 0))
+			pixel = obj & 0x0F;
+	}
+
+	if (!ppu->skip_frame)
+		ppu->screen.pixels[ppu->ly][fifo.lx] = pixel;
+	++fifo.lx;
+}
+
+
+// the next sprite of the line is due once its x reaches the pixel being
+// shifted out. it waits for the fetcher to have a tile ready and the
+// fifo not to be empty, then takes 6 dots. returns true while stalling
+bool step_fifo_sprite(const Memory& mem, Ppu* const ppu)
+{
+	PixelFifo& fifo = ppu->fifo;
 	const auto ly = ppu->ly;
+	if (!ppu->lcdc.obj_on || fifo.next_sprite >= ppu->sprites.counts[ly])
+		return false;
+
+	const int offset = ppu->sprites.offsets[ly][fifo.next_sprite];
+	if (mem.oam[offset + 1] > fifo.lx + 8)
+		return false;
+
+	if (fifo.fetch_dots < 6 || fifo.bg_count == 0) {
+		step_fifo_fetcher(mem, ppu);
+	} else if (++fifo.sprite_dots == 6) {
+		merge_fifo_sprite(mem, offset, ppu);
+		fifo.sprite_dots = 0;
+		++fifo.next_sprite;
+	}
+
+	return true;
+}
+
+
+void step_fifo_fetcher(const Memory& mem, Ppu* const ppu)
+{
+	PixelFifo& fifo = ppu->fifo;
+	const auto lcdc = ppu->lcdc;
+	const bool win = fifo.in_window;
+	const int y = win ? fifo.win_line : (ppu->ly + ppu->scy) & 0xFF;
+	const int data = get_bg_tile(fifo.tile_id, lcdc.tile_data) * 16 + (y & 7) * 2;
+
+	if (fifo.fetch_dots < 6) {
+		switch (++fifo.fetch_dots) {
+		case 2: {
+			const int x = win ? fifo.fetch_x : (ppu->scx >> 3) + fifo.fetch_x;
+			const int map = (win ? lcdc.win_map : lcdc.bg_map) ? 0x1C00 : 0x1800;
+			fifo.tile_id = mem.vram[map + ((y >> 3) & 31) * 32 + (x & 31)];
+			break;
+		}
+		case 4: fifo.data_low = mem.vram[data]; break;
+		case 6: fifo.data_high = mem.vram[data + 1]; break;
+		default: break;
+		}
+		return;
+	}
+
+	if (fifo.bg_count != 0)
+		return;
+
+	for (int p = 0; p < 8; ++p) {
+		const int shift = 7 - p;
+		fifo.bg[p] = ((fifo.data_low >> shift) & 1) | (((fifo.data_high >> shift) & 1) << 1);
+	}
+
+	fifo.bg_count = 8;
+	fifo.fetch_dots = 0;
+	++fifo.fetch_x;
+}
+
+
+// sprite pixels only fill the obj fifo where it has none yet or a
+// transparent one, so sprites fetched earlier keep their priority.
+// the ones left of the screen lose the pixels already past
+void merge_fifo_sprite(const Memory& mem, const int offset, Ppu* const ppu)
+{
+	PixelFifo& fifo = ppu->fifo;
+	const int yres = ppu->lcdc.obj_size ? 16 : 8;
+	const auto flags = mem.oam[offset + 3];
+	const int ly_ypos_diff = (ppu->ly - (mem.oam[offset] - 16)) & (yres - 1);
+	const int sprite_y = (flags&0x40) ? (yres - 1 - ly_ypos_diff) : ly_ypos_diff;
+	const int pattern = yres == 8 ? mem.oam[offset + 2] : (mem.oam[offset + 2] & 0xFE);
+	const uint8_t* const data = &mem.vram[pattern * 16 + sprite_y * 2];
+	const bool xflip = (flags&0x20) != 0;
+	const uint8_t attrs = (((flags&0x10) ? kPaletteObp1 : kPaletteObp0) << 2) | (flags&0x80);
+
+	const int skip = fifo.lx + 8 - mem.oam[offset + 1];
+	if (skip >= 8)
+		return;
+
+	for (int p = skip; p < 8; ++p) {
+		const int shift = xflip ? p : 7 - p;
+		const uint8_t colnum = ((data[0] >> shift) & 1) | (((data[1] >> shift) & 1) << 1);
+		const int slot = p - skip;
+		uint8_t& dest = fifo.obj[(fifo.obj_head + slot) & 7];
+		if (slot >= fifo.obj_count || ((dest & 3) == 0 && colnum != 0))
+			dest = colnum | attrs;
+	}
+
+	fifo.obj_count = max(fifo.obj_count, static_cast<uint8_t>(8 - skip));
+}
+
+
+// the line starts from the registers as they were before its first
+// write, each segment ends where the next write takes effect. the last
+// one is drawn with the registers as they are now, which also covers
+// writes past the log's capacity. sprites are drawn once afterwards
+void draw_logged_line(const Memory& mem, Ppu* const ppu)
+{
+	const LineLog& log = ppu->line_log;
+	const LineRegisters live = get_line_registers(*ppu);
+	LineRegisters regs = log.start;
+	set_line_registers(regs, ppu);
+
+	uint8_t* const palettes = ppu->screen.palettes[ppu->ly];
+	palettes[kPaletteBgp] = regs.bgp;
+	palettes[kPaletteObp0] = regs.obp0;
+	palettes[kPaletteObp1] = regs.obp1;
+	ppu->screen.split_counts[ppu->ly] = 0;
+
+	int x = 0;
+	for (int i = 0; i < log.count; ++i) {
+		const LineWrite& write = log.writes[i];
+		if (write.x > x) {
+			update_bg_scanline(mem, x, write.x, ppu);
+			update_win_scanline(mem, x, write.x, ppu);
+			x = write.x;
+		}
+		write_line_register(write, &regs);
+		set_line_registers(regs, ppu);
+		record_palettes(x, ppu);
+	}
+
+	set_line_registers(live, ppu);
+	record_palettes(x, ppu);
+	update_bg_scanline(mem, x, 160, ppu);
+	update_win_scanline(mem, x, 160, ppu);
+}
+
+
+void write_line_register(const LineWrite& write, LineRegisters* const regs)
+{
+	switch (write.address) {
+	case 0x40: regs->lcdc = write.value; break;
+	case 0x42: regs->scy = write.value; break;
+	case 0x43: regs->scx = write.value; break;
+	case 0x47: regs->bgp = write.value; break;
+	case 0x48: regs->obp0 = write.value; break;
+	case 0x49: regs->obp1 = write.value; break;
+	case 0x4A: regs->wy = write.value; break;
+	case 0x4B: regs->wx = write.value; break;
+	default: break;
+	}
+}
+
+
+// adds a palette split at 'x' when the palettes changed since the last
+// one, splits at the same x are merged and a full line keeps the last
+void record_palettes(const int x, Ppu* const ppu)
+{
+	Frame& frame = ppu->screen;
+	const auto ly = ppu->ly;
+	auto& count = frame.split_counts[ly];
+	const uint8_t* const last = count > 0 ? frame.splits[ly][count - 1].values : frame.palettes[ly];
+	if (last[kPaletteBgp] == ppu->bgp && last[kPaletteObp0] == ppu->obp0 &&
+	    last[kPaletteObp1] == ppu->obp1)
+		return;
+
+	if (count == 0 || (frame.splits[ly][count - 1].x != x && count < kPaletteSplitsMax))
+		++count;
+
+	PaletteSplit& split = frame.splits[ly][count - 1];
+	split.x = static_cast<uint8_t>(x);
+	split.values[kPaletteBgp] = ppu->bgp;
+	split.values[kPaletteObp0] = ppu->obp0;
+	split.values[kPaletteObp1] = ppu->obp1;
+}
+
+
+// decides whether the frame starting at line 0 is drawn. the tile
+// cache and sprite lists keep their dirty marks while frames are skipped
+void start_frame(Ppu* const ppu)
+{
+	ppu->fifo.win_line = 0;
+	ppu->fifo.wy_hit = false;
+
+	switch (ppu->render.mode) {
+	case RenderMode::Always:
+	case RenderMode::NextFrame:
+		ppu->skip_frame = false;
+		break;
+	case RenderMode::EveryNth:
+		ppu->skip_frame = ppu->render_count != 0;
+		if (++ppu->render_count >= ppu->render.interval)
+			ppu->render_count = 0;
+		break;
+	case RenderMode::Never:
+		ppu->skip_frame = true;
+		break;
+	}
+}
+
+
+void update_tile_cache(const Memory& mem, Ppu* const ppu)
+{
+	TileCache* const tiles = &ppu->tiles;
+	for (size_t i = 0; i < arr_size(tiles->dirty); ++i) {
+		uint64_t dirty = tiles->dirty[i];
+		if (dirty == 0)
+			continue;
+
+		tiles->dirty[i] = 0;
+		for (auto& modes : ppu->maps) {
+			for (auto& map : modes)
+				map.stale_tiles[i] |= dirty;
+		}
+
+		do {
+			const int tile = static_cast<int>(i * 64) + __builtin_ctzll(dirty);
+			decode_tile(&mem.vram[tile * 16], tile, tiles);
+			dirty &= dirty - 1;
+		} while (dirty != 0);
+	}
+}
+
+
+void decode_tile(const uint8_t* const data, const int tile, TileCache* const tiles)
+{
+	for (int y = 0; y < 8; ++y) {
+		const uint8_t low = data[y * 2];
+		const uint8_t high = data[y * 2 + 1];
+		for (int x = 0; x < 8; ++x) {
+			const int shift = 7 - x;
+			const uint8_t colnum = ((low >> shift) & 1) | (((high >> shift) & 1) << 1);
+			tiles->pixels[tile][y][x] = colnum;
+			tiles->xflipped[tile][y][shift] = colnum;
+		}
+	}
+}
+
+
+// draws the dirty cells of a map in the current addressing mode,
+// after finding the cells using tiles decoded again
+const MapCache& update_map_cache(const Memory& mem, const int map_index, Ppu* const ppu)
+{
+	const bool unsig_data = ppu->lcdc.tile_data != 0;
+	MapCache& map = ppu->maps[map_index][unsig_data];
+	const uint8_t* const ids = &mem.vram[0x1800 + map_index * kMapCells];
+
+	uint64_t stale = 0;
+	for (const auto word : map.stale_tiles)
+		stale |= word;
+
+	if (stale != 0) {
+		for (int cell = 0; cell < kMapCells; ++cell) {
+			const int tile = get_bg_tile(ids[cell], unsig_data);
+			if ((map.stale_tiles[tile >> 6] >> (tile & 63)) & 1)
+				map.dirty[cell >> 6] |= uint64_t(1) << (cell & 63);
+		}
+	}
+
+	memset(map.stale_tiles, 0, sizeof(map.stale_tiles));
+
+	for (int i = 0; i < kMapCells / 64; ++i) {
+		uint64_t dirty = map.dirty[i];
+		map.dirty[i] = 0;
+		while (dirty != 0) {
+			const int cell = i * 64 + __builtin_ctzll(dirty);
+			const int tile = get_bg_tile(ids[cell], unsig_data);
+			const int x = (cell & 31) * 8;
+			const int y = (cell >> 5) * 8;
+			for (int row = 0; row < 8; ++row)
+				memcpy(&map.pixels[y + row][x], ppu->tiles.pixels[tile][row], 8);
+			dirty &= dirty - 1;
+		}
+	}
+
+	return map;
+}
+
+
+// bg and window pixels are drawn with bgp, whose PaletteId is 0,
+// so their pixels are the map's color numbers as they are
+void update_bg_scanline(const Memory& mem, const int xbeg, const int xend, Ppu* const ppu)
+{
+	static_assert(kPaletteBgp == 0, "");
+	const auto lcdc = ppu->lcdc;
+	const auto ly = ppu->ly;
+	uint8_t* const line = ppu->screen.pixels[ly];
 	if (!lcdc.bg_on) {
-		memset(&ppu->screen[ly][0], 0xFF, sizeof(uint32_t) * 160);
+		memset(&line[xbeg], kPaletteBlank << 2, xend - xbeg);
 		return;
 	} else if (lcdc.win_on && ly >= ppu->wy && ppu->wx <= 7) {
 		return;
 	}
 
-	const auto scx = ppu->scx;
-	const auto scy = ppu->scy;
-	const bool unsig_data = lcdc.tile_data != 0;
-
-	const int lydiv = ly >> 3;
-	const int lymod = ly & 7;
-	const int scxdiv = scx >> 3;
-	const int scxmod = scx & 7;
-	const int scydiv = scy >> 3;
-	const int scymod = scy & 7;
-	const int ly_scy_mods = lymod + scymod;
-	const int ly_scy_divs = lydiv + scydiv;
-	const int data_add = (ly_scy_mods&7) * 2;
-	const int map_add = 
-	  ((ly_scy_divs + ((ly_scy_mods > 7) ? 1 : 0))&31) * 32;
-
-	const uint8_t* const tile_data =
-	  (unsig_data ? &mem.vram[0] : &mem.vram[0x1000]) + data_add;
-	const uint8_t* const map =
-	  (lcdc.bg_map ? &mem.vram[0x1C00] : &mem.vram[0x1800]) + map_add;
-
-	const auto get_row = 
-	[map, scxdiv, unsig_data, tile_data](const int mapx)-> uint16_t {
-		const uint8_t id = map[(mapx + scxdiv)&31];
-		const int addr =
-		  (unsig_data ? id : static_cast<int8_t>(id)) * 16;
-		return concat_bytes(tile_data[addr + 1], tile_data[addr]);
-	};
-	
-	Scanline scanline {&ppu->screen[ly][0], ppu->bgp.colors};
-
-	if (scxmod == 0) {
-		for (int x = 0; x < 20; ++x)
-			fill_scanline(0, 8, get_row(x), &scanline);
-	} else {
-		fill_scanline(scxmod, 8, get_row(0), &scanline);
-		for (int x = 1; x < 20; ++x)
-			fill_scanline(0, 8, get_row(x), &scanline);
-		fill_scanline(0, scxmod, get_row(20), &scanline);
-	}
+	const auto& map = update_map_cache(mem, lcdc.bg_map, ppu);
+	const uint8_t* const row = map.pixels[(ly + ppu->scy) & 0xFF];
+
+	// the map wraps around horizontally
+	const int mapx = (ppu->scx + xbeg) & 0xFF;
+	const int count = xend - xbeg;
+	const int first = min(count, 256 - mapx);
+	memcpy(&line[xbeg], &row[mapx], first);
+	memcpy(&line[xbeg + first], row, count - first);
 }
 
-void update_win_scanline(const Memory& mem, Ppu* const ppu)
+void update_win_scanline(const Memory& mem, const int xbeg, const int xend, Ppu* const ppu)
 {
 	const auto ly = ppu->ly;
 	const auto lcdc = ppu->lcdc;
 	const int wy = ppu->wy;
 	const int wx = ppu->wx - 7;
-	if (!lcdc.win_on || ly < wy || wx >= 160)
+	const int wx_max = max(xbeg, wx);
+	if (!lcdc.win_on || ly < wy || wx_max >= xend)
 		return;
 
-	const int wx_max = max(0, wx);
-	const bool unsig_data = lcdc.tile_data != 0;
-	const int data_add = ((ly - wy) & 7) * 2;
-	const int map_add = (((ly - wy) >> 3)&31) * 32;
-	const uint8_t* const tile_data = 
-	  (unsig_data ? &mem.vram[0] : &mem.vram[0x1000]) + data_add;
-	const uint8_t* const map =
-	  (lcdc.win_map ? &mem.vram[0x1C00] : &mem.vram[0x1800]) + map_add;
-
-	const auto get_row = 
-	[map, unsig_data, tile_data] (const int mapx) -> uint16_t {
-		const uint8_t id = map[mapx&31];
-		const int addr =
-		  (unsig_data ? id : static_cast<int8_t>(id)) * 16;
-		return concat_bytes(tile_data[addr + 1], tile_data[addr]);
-	};
-
-	Scanline scanline{&ppu->screen[ly][wx_max], ppu->bgp.colors};
-
-	int xbeg = 0;
-	int to_draw = (160 - wx_max);
-	if (wx < 0) {
-		const int abswx = -wx;
-		fill_scanline(abswx, 8, get_row(0), &scanline);
-		++xbeg;
-		to_draw -= (8 - abswx);
-	}
+	const auto& map = update_map_cache(mem, lcdc.win_map, ppu);
+	const uint8_t* const row = map.pixels[(ly - wy) & 0xFF];
+	memcpy(&ppu->screen.pixels[ly][wx_max], &row[wx_max - wx], xend - wx_max);
+}
 
-	for (int x = xbeg; to_draw > 0; ++x) {
-		const int pend = min(8, to_draw);
-		to_draw -= pend;
-		fill_scanline(0, pend, get_row(x), &scanline);
+void update_sprite_lists(const Memory& mem, Ppu* const ppu)
+{
+	static_assert((sizeof(mem.oam) % 4) == 0, "");
+	auto& sprites = ppu->sprites;
+	const int yres = ppu->lcdc.obj_size ? 16 : 8;
+
+	memset(sprites.counts, 0, sizeof(sprites.counts));
+	for (int i = 0; i < static_cast<int>(sizeof(mem.oam)); i += 4) {
+		const int ypos = mem.oam[i] - 16;
+		const int xpos = mem.oam[i + 1];
+		const int lbeg = max(ypos, 0);
+		const int lend = min(ypos + yres, 144);
+		for (int line = lbeg; line < lend; ++line) {
+			auto& count = sprites.counts[line];
+			if (count == kSpritesPerLine)
+				continue;
+
+			// insertion by x, equal x keeps oam order
+			uint8_t* const offsets = sprites.offsets[line];
+			int pos = count++;
+			for (; pos > 0 && mem.oam[offsets[pos - 1] + 1] > xpos; --pos)
+				offsets[pos] = offsets[pos - 1];
+			offsets[pos] = i;
+		}
 	}
+
+	sprites.dirty = false;
 }
 
+
+// sprites are drawn from the highest priority down, each pixel belongs
+// to the first sprite with a non zero color number over it, whether or
+// not that sprite shows through the background
 void update_sprite_scanline(const Memory& mem, Ppu* const ppu)
 {
-	static_assert((sizeof(mem.oam) % 4) == 0, "");
 	const auto lcdc = ppu->lcdc;
 
 	if (!lcdc.obj_on)
 		return;
 
-	const auto& bgp = ppu->bgp.colors;
-	const auto& obp0 = ppu->obp0.colors;
-	const auto& obp1 = ppu->obp1.colors;
+	if (ppu->sprites.dirty)
+		update_sprite_lists(mem, ppu);
+
 	const auto ly = ppu->ly;
 	const int yres = lcdc.obj_size ? 16 : 8;
+	const int count = ppu->sprites.counts[ly];
+	const uint8_t* const offsets = ppu->sprites.offsets[ly];
+	uint8_t claimed[160] {};
 
-	for (int i = sizeof(mem.oam) - 4; i >= 0; i -= 4) {
+	for (int s = 0; s < count; ++s) {
+		const int i = offsets[s];
 		const int ypos = mem.oam[i] - 16;
 		const int xpos = mem.oam[i + 1] - 8;
-		if (ly < ypos || ly >= (ypos + yres) ||
-		    xpos <= -8 || xpos >= 160)
+		if (xpos <= -8 || xpos >= 160)
 			continue;
 
 		const auto ly_ypos_diff = ly - ypos;
 		const auto flags = mem.oam[i + 3];
-		const bool priority = (flags&0x80) != 0;
+		const bool behind_bg = (flags&0x80) != 0;
 		const bool yflip = (flags&0x40) != 0;
 		const bool xflip = (flags&0x20) != 0;
-		const auto& pal = (flags&0x10) ? obp1 : obp0;
-
-		const auto get_tile_y = [yflip](const int diff) {
-			return (yflip ? (7 - diff) : diff) * 2;
-		};
-
-		uint16_t row;
-		if (yres == 8) {
-			const auto tile = &mem.vram[mem.oam[i + 2] * 16];
-			const auto tile_y = get_tile_y(ly_ypos_diff);
-			row = concat_bytes(tile[tile_y + 1], tile[tile_y]);
-		} else {
-			const int pattern = mem.oam[i + 2];
-			const uint8_t* tile;
-			int tile_y;
-			if (ly_ypos_diff < 8) {
-				tile = yflip
-				  ? &mem.vram[(pattern | 0x01) * 16]
-				  : &mem.vram[(pattern & 0xFE) * 16];
-				tile_y = get_tile_y(ly_ypos_diff);
-			} else {
-				tile = yflip 
-				  ? &mem.vram[(pattern & 0xFE) * 16]
-				  : &mem.vram[(pattern | 0x01) * 16];
-				tile_y = get_tile_y(ly_ypos_diff - 8);
-			}
-			row = concat_bytes(tile[tile_y + 1], tile[tile_y]);
+		const uint8_t palette = ((flags&0x10) ? kPaletteObp1 : kPaletteObp0) << 2;
+
+		// 8x16 sprites are an even tile followed by the next one
+		const int sprite_y = yflip ? (yres - 1 - ly_ypos_diff) : ly_ypos_diff;
+		const int pattern = yres == 8 ? mem.oam[i + 2] : (mem.oam[i + 2] & 0xFE);
+		const int tile = pattern + (sprite_y >> 3);
+		const uint8_t* const row = xflip
+		  ? ppu->tiles.xflipped[tile][sprite_y & 7]
+		  : ppu->tiles.pixels[tile][sprite_y & 7];
+
+		if (xpos >= 0 && xpos <= 152) {
+			blend_sprite_row(row, palette, behind_bg,
+			                 &claimed[xpos], &ppu->screen.pixels[ly][xpos]);
+			continue;
 		}
 
-		uint32_t* line;
-		int pbeg, pend;
-		if (xpos < 0) {
-			line = &ppu->screen[ly][0];
-			pbeg = -xpos;
-			pend = 8;
-		} else {
-			line = &ppu->screen[ly][xpos];
-			pbeg = 0;
-			pend = min(160 - xpos, 8);
+		// clipped by the screen edges
+		const int pbeg = max(-xpos, 0);
+		const int pend = min(160 - xpos, 8);
+		uint8_t* const line = ppu->screen.pixels[ly];
+		for (int p = pbeg; p < pend; ++p) {
+			const int x = xpos + p;
+			if (row[p] == 0 || claimed[x])
+				continue;
+			claimed[x] = 0xFF;
+			if (!behind_bg || get_pixel_color_number(line[x]) == 0)
+				line[x] = row[p] | palette;
 		}
+	}
+}
 
-		for (int p = pbeg; p < pend; ++p, ++line) {
-			int color_num = 0;	
-			if (!xflip) {
-				if (row & (0x80 >> p))
-					++color_num;
-				if (row & (0x8000 >> p))
-					color_num += 2;
-			} else {
-				if (row & (0x01 << p))
-					++color_num;
-				if (row & (0x0100 << p))
-					color_num += 2;
-			}
-			if (color_num != 0 && (!priority || *line == bgp[0]))
-				*line = pal[color_num];
-		}
+// draws the non zero color numbers of a sprite's tile row over 'dest'
+// where no higher priority sprite 'claimed' the pixel before. sprites
+// behind the background only show over its color number 0
+#if defined(__SSE2__)
+
+void blend_sprite_row(const uint8_t* const row, const uint8_t palette, const bool behind_bg,
+                      uint8_t* const claimed, uint8_t* const dest)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i colnums = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row));
+	const __m128i line = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(dest));
+	const __m128i taken = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(claimed));
+	const __m128i transparent = _mm_cmpeq_epi8(colnums, zero);
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(claimed),
+	                 _mm_or_si128(taken, _mm_andnot_si128(transparent, _mm_set1_epi8(-1))));
+
+	__m128i keep = _mm_or_si128(transparent, taken);
+	if (behind_bg) {
+		const __m128i bg_colnums = _mm_and_si128(line, _mm_set1_epi8(0x03));
+		const __m128i bg_set = _mm_andnot_si128(_mm_cmpeq_epi8(bg_colnums, zero),
+		                                        _mm_set1_epi8(-1));
+		keep = _mm_or_si128(keep, bg_set);
 	}
+	const __m128i pixels = _mm_or_si128(colnums, _mm_set1_epi8(palette));
+	const __m128i result = _mm_or_si128(_mm_and_si128(keep, line), _mm_andnot_si128(keep, pixels));
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(dest), result);
 }
 
-void fill_scanline(const int pbeg, const int pend,
-                   const uint16_t row, Scanline* const scanline)
+#else
+
+void blend_sprite_row(const uint8_t* const row, const uint8_t palette, const bool behind_bg,
+                      uint8_t* const claimed, uint8_t* const dest)
 {
-	auto& data = scanline->data;
-	auto& colors = scanline->colors;
-	for (int p = pbeg; p < pend; ++p) {
-		int colnum = 0;
-		if (row & (0x80 >> p))
-			++colnum;
-		if (row & (0x8000 >> p))
-			colnum += 2;
-		*data++ = colors[colnum];
+	for (int p = 0; p < 8; ++p) {
+		if (row[p] == 0 || claimed[p])
+			continue;
+		claimed[p] = 0xFF;
+		if (!behind_bg || get_pixel_color_number(dest[p]) == 0)
+			dest[p] = row[p] | palette;
 	}
 }
 
+#endif
+
+
+// in the 0x8800 addressing mode ids are signed offsets from tile 256
+int get_bg_tile(const uint8_t id, const bool unsig_data)
+{
+	return unsig_data ? id : 256 + static_cast<int8_t>(id);
+}
+
 
 
 } // namespace gbx
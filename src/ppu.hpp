@@ -3,17 +3,12 @@
 #include "common.hpp"
 #include "hwstate.hpp"
 #include "memory.hpp"
+#include "frame.hpp"
+#include "sinks.hpp"
 
 namespace gbx {
 
 
-enum Color : uint32_t {
-	kBlack = 0x00000000,
-	kWhite = 0x00FFFFFF,
-	kLightGrey = 0x00909090,
-	kDarkGrey = 0x00555555
-};
-
 enum class PpuMode : uint8_t {
 	HBlank = 0x0,
 	VBlank = 0x1,
@@ -21,12 +16,128 @@ enum class PpuMode : uint8_t {
 	Transfer = 0x3
 };
 
-struct Palette {
+// how mode 3 is emulated. Scanline draws each line at once as mode 3
+// ends and always takes 172 cycles. Fifo runs the fetcher and the pixel
+// fifo dot by dot, so mode 3 takes longer with SCX, the window and
+// sprites and registers take effect at the pixel being shifted out
+enum class PpuAccuracy : uint8_t {
+	Scanline,
+	Fifo
+};
+
+// which frames the ppu draws and hands to the frame sink. timing,
+// STAT, LY and interrupts are the same whatever the mode
+enum class RenderMode : uint8_t {
+	Always,
+	EveryNth,  // the first of every 'interval' frames
+	NextFrame, // the next whole frame, then Never
+	Never
+};
+
+struct RenderPolicy {
+	RenderMode mode;
+	uint8_t interval;
+};
+
+constexpr const int kTileCount = 384;
+constexpr const int kMapCells = 32 * 32;
+constexpr const int kLineWritesMax = 8;
+constexpr const int kTransferLeadCycles = 12;
+constexpr const int kSpritesPerLine = 10;
+
+// the vram tile data decoded to one color number per byte, plus
+// horizontally flipped copies for sprites. tiles written since the
+// last decode have their bit set in 'dirty', they are decoded again
+// before the next scanline is drawn. zeroed vram decodes to zeroed
+// tiles, so a zeroed cache is in sync.
+struct TileCache {
+	uint64_t dirty[kTileCount / 64];
+	uint8_t pixels[kTileCount][8][8];
+	uint8_t xflipped[kTileCount][8][8];
+};
+
+// one of the two tile maps drawn to 256x256 color numbers with one of
+// the two tile data addressing modes. 'dirty' marks the 8x8 cells to
+// draw again, set by writes to the map. 'stale_tiles' marks the tiles
+// decoded again since the map was last brought up to date, the cells
+// using them are marked dirty then. zeroed vram draws to zeroed cells
+// in either mode, so a zeroed cache is in sync
+struct MapCache {
+	uint64_t dirty[kMapCells / 64];
+	uint64_t stale_tiles[kTileCount / 64];
+	uint8_t pixels[256][256];
+};
+
+// the registers the renderer reads, as a line started
+struct LineRegisters {
+	uint8_t lcdc;
+	uint8_t scy;
+	uint8_t scx;
+	uint8_t bgp;
+	uint8_t obp0;
+	uint8_t obp1;
+	uint8_t wy;
+	uint8_t wx;
+};
+
+// a write to one of them ( low byte of its address ) in mode 3,
+// taking effect from pixel 'x' of the line on
+struct LineWrite {
+	uint8_t x;
+	uint8_t address;
 	uint8_t value;
-	Color colors[4];
+};
+
+// the writes made while the current line is drawn, the line is drawn
+// in segments split at them. 'start' is taken at the first write
+struct LineLog {
+	LineRegisters start;
+	uint8_t count;
+	LineWrite writes[kLineWritesMax];
+};
+
+// the oam offsets of the sprites each line shows, at most 10 like the
+// hardware picks in oam order, sorted by priority: lower x first, then
+// lower oam offset. rebuilt before the next scanline once 'dirty' is
+// set by oam writes or obj_size changes. zeroed oam has no sprite on
+// screen, so zeroed lists are in sync
+struct SpriteLists {
+	uint8_t counts[144];
+	uint8_t offsets[144][kSpritesPerLine];
+	bool dirty;
+};
+
+// the Fifo accuracy's progress through the current mode 3. 'dots' ran so
+// far and 'lx' pixels are out, the line ends with the 160th pixel after
+// 'length' dots. the fetcher takes 2 dots per step: tile id, data low,
+// data high, then waits to push. 'win_line' counts the lines the window
+// showed on this frame, 'wy_hit' is set once ly matched wy
+struct PixelFifo {
+	uint8_t bg[8];
+	uint8_t obj[8];
+	uint8_t bg_count;
+	uint8_t obj_head;
+	uint8_t obj_count;
+	uint8_t fetch_dots;
+	uint8_t fetch_x;
+	uint8_t tile_id;
+	uint8_t data_low;
+	uint8_t data_high;
+	uint8_t lx;
+	uint8_t discard;
+	uint8_t warmup;
+	uint8_t next_sprite;
+	uint8_t sprite_dots;
+	uint8_t win_line;
+	bool in_window;
+	bool wy_hit;
+	int16_t dots;
+	int16_t length;
 };
 
 
+struct PpuWorker;
+
 struct Ppu {
 	int16_t clock;
 
@@ -62,15 +173,35 @@ struct Ppu {
 	uint8_t wx;
 	uint8_t ly;
 	uint8_t lyc;
-	Palette bgp;
-	Palette obp0;
-	Palette obp1;
+	uint8_t bgp;
+	uint8_t obp0;
+	uint8_t obp1;
+	TileCache tiles;
+	// by map, then by lcdc.tile_data: games switching the addressing
+	// mode mid frame draw each map from the cache kept in that mode
+	MapCache maps[2][2];
+	SpriteLists sprites;
+	RenderPolicy render;
+	uint8_t render_count;
+	bool skip_frame;
+	LineLog line_log;
+	PpuAccuracy accuracy;
+	PixelFifo fifo;
+	PpuWorker* worker;
 
-	static uint32_t screen[144][160];
+	Frame screen;
 };
 
 
-extern void update_ppu(int16_t cycles, const Memory& mem, HWState* hwstate, Ppu* ppu);
+// instantiated for both accuracies, the caller picks one per event
+template<PpuAccuracy accuracy>
+void update_ppu(int32_t cycles, const Memory& mem, const Sinks& sinks,
+                HWState* hwstate, Ppu* ppu);
+
+// draws line 'ly' of the screen from the registers as they are, and
+// the writes logged while it was drawn. Scanline's mode 3 calls it as
+// it ends, or the ppu worker for the lines queued to it
+extern void draw_scanline(const Memory& mem, Ppu* ppu);
 
 inline PpuMode get_ppu_mode(const Ppu& ppu)
 {
@@ -83,6 +214,22 @@ inline int16_t get_ppu_mode_clock_limit(const PpuMode mode)
 	return limits[static_cast<size_t>(mode)];
 }
 
+// the cycles from the ppu's clock to its next mode change, or the least
+// it can be: Fifo's mode 3 outputs a pixel per dot at most, its hblank
+// takes what mode 3 left of the 376 cycles after mode 2
+inline int32_t get_ppu_event_cycles(const Ppu& ppu)
+{
+	const auto mode = get_ppu_mode(ppu);
+	if (ppu.accuracy == PpuAccuracy::Fifo) {
+		if (mode == PpuMode::Transfer)
+			return max(ppu.fifo.dots + (160 - ppu.fifo.lx) - ppu.clock, 1);
+		else if (mode == PpuMode::HBlank)
+			return 376 - ppu.fifo.length - ppu.clock;
+	}
+
+	return get_ppu_mode_clock_limit(mode) - ppu.clock;
+}
+
 inline void set_ppu_mode(const PpuMode mode, Ppu* const ppu, HWState* const hwstate)
 {
 	if (get_ppu_mode(*ppu) == mode)
@@ -96,19 +243,66 @@ inline void set_ppu_mode(const PpuMode mode, Ppu* const ppu, HWState* const hwst
 	ppu->stat.mode = mode_value;
 }
 
-inline void write_palette(const uint8_t val, Palette* const pal)
+inline LineRegisters get_line_registers(const Ppu& ppu)
+{
+	return { ppu.lcdc.value, ppu.scy, ppu.scx, ppu.bgp,
+	         ppu.obp0, ppu.obp1, ppu.wy, ppu.wx };
+}
+
+inline void set_line_registers(const LineRegisters& regs, Ppu* const ppu)
+{
+	ppu->lcdc.value = regs.lcdc;
+	ppu->scy = regs.scy;
+	ppu->scx = regs.scx;
+	ppu->bgp = regs.bgp;
+	ppu->obp0 = regs.obp0;
+	ppu->obp1 = regs.obp1;
+	ppu->wy = regs.wy;
+	ppu->wx = regs.wx;
+}
+
+// 'cycles' is how far into mode 3 the write lands. lines being skipped
+// don't need it and writes before the first pixel cover the whole line
+inline void log_line_write(const int32_t cycles, const uint16_t address,
+                           const uint8_t value, Ppu* const ppu)
+{
+	if (!ppu->lcdc.lcd_on || get_ppu_mode(*ppu) != PpuMode::Transfer || ppu->skip_frame)
+		return;
+
+	auto& log = ppu->line_log;
+	const int x = min(max(cycles - kTransferLeadCycles, 0), 160);
+	if (x == 0 && log.count == 0)
+		return;
+
+	if (log.count == 0)
+		log.start = get_line_registers(*ppu);
+	if (log.count < kLineWritesMax)
+		log.writes[log.count++] = { static_cast<uint8_t>(x), static_cast<uint8_t>(address), value };
+}
+
+// the frame being drawn when the policy changes is dropped,
+// the new policy starts with the next one
+inline void set_render_policy(const RenderPolicy policy, Ppu* const ppu)
+{
+	ppu->render = policy;
+	ppu->render_count = 0;
+	ppu->skip_frame = true;
+}
+
+inline void mark_vram_dirty(const int_fast32_t vram_offset, Ppu* const ppu)
 {
-	constexpr const Color colors[4] { kWhite, kLightGrey, kDarkGrey, kBlack };
-	if (pal->value != val) {
-		pal->value = val;
-		pal->colors[0] = colors[val&0x03];
-		pal->colors[1] = colors[(val&0x0C)>>2];
-		pal->colors[2] = colors[(val&0x30)>>4];
-		pal->colors[3] = colors[(val&0xC0)>>6];
+	if (vram_offset < kTileCount * 16) {
+		const int tile = vram_offset >> 4;
+		ppu->tiles.dirty[tile >> 6] |= uint64_t(1) << (tile & 63);
+	} else {
+		const int cell = vram_offset & (kMapCells - 1);
+		for (auto& map : ppu->maps[(vram_offset >> 10) & 1])
+			map.dirty[cell >> 6] |= uint64_t(1) << (cell & 63);
 	}
 }
 
 
+
 } // namespace gbx
 #endif
 
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gameboy.hpp"
+
+namespace gbx {
+
+static void* run_ppu_worker(void* arg);
+static bool has_video_changes(const Memory& mem, const Ppu& ppu);
+static void take_snapshot(const Memory& mem, Ppu* ppu);
+static void apply_snapshot(const PpuSnapshot& snapshot, Ppu* ppu);
+static void mark_caches_dirty(Ppu* ppu);
+static PpuJob* acquire_job(PpuWorker* worker);
+static void push_job(PpuWorker* worker);
+static void publish_jobs(PpuWorker* worker);
+static void wait_semaphore(sem_t* sem);
+
+
+// the worker only draws what Scanline's mode 3 would, so Fifo runs on
+// the emulation thread. turning it off brings the lines it drew to the
+// ppu's screen and has the ppu's caches rebuilt from vram and oam
+bool set_ppu_async(const bool async, Gameboy* const gb)
+{
+	Ppu* const ppu = &gb->ppu;
+	if (async == (ppu->worker != nullptr))
+		return true;
+
+	if (!async) {
+		PpuWorker* const worker = ppu->worker;
+		sync_ppu_worker(gb);
+		acquire_job(worker)->type = PpuJobType::Quit;
+		push_job(worker);
+		publish_jobs(worker);
+		pthread_join(worker->thread, nullptr);
+
+		memcpy(&ppu->screen, &worker->ppu.screen, sizeof(ppu->screen));
+		mark_caches_dirty(ppu);
+		sem_destroy(&worker->jobs_filled);
+		sem_destroy(&worker->jobs_free);
+		sem_destroy(&worker->snapshots_free);
+		sem_destroy(&worker->synced);
+		free(worker);
+		ppu->worker = nullptr;
+		return true;
+	}
+
+	if (ppu->accuracy != PpuAccuracy::Scanline) {
+		fputs("The ppu worker only runs the Scanline accuracy\n", stderr);
+		return false;
+	}
+
+	// zeroed, the worker's caches are in sync with zeroed vram
+	// and oam, its first snapshot has them all drawn again
+	PpuWorker* const worker = static_cast<PpuWorker*>(calloc(1, sizeof(PpuWorker)));
+	if (worker == nullptr) {
+		perror("Couldn't allocate ppu worker");
+		return false;
+	}
+
+	sem_init(&worker->jobs_filled, 0, 0);
+	sem_init(&worker->jobs_free, 0, kPpuJobCount);
+	sem_init(&worker->snapshots_free, 0, kPpuSnapshotCount);
+	sem_init(&worker->synced, 0, 0);
+	worker->snapshot = -1;
+	memcpy(&worker->ppu.screen, &ppu->screen, sizeof(ppu->screen));
+
+	const int err = pthread_create(&worker->thread, nullptr, run_ppu_worker, worker);
+	if (err != 0) {
+		fprintf(stderr, "Couldn't start ppu worker: %s\n", strerror(err));
+		sem_destroy(&worker->jobs_filled);
+		sem_destroy(&worker->jobs_free);
+		sem_destroy(&worker->snapshots_free);
+		sem_destroy(&worker->synced);
+		free(worker);
+		return false;
+	}
+
+	ppu->worker = worker;
+	return true;
+}
+
+
+void sync_ppu_worker(Gameboy* const gb)
+{
+	PpuWorker* const worker = gb->ppu.worker;
+	if (worker == nullptr)
+		return;
+
+	acquire_job(worker)->type = PpuJobType::Sync;
+	push_job(worker);
+	publish_jobs(worker);
+	wait_semaphore(&worker->synced);
+}
+
+
+const Frame& get_ppu_screen(Gameboy* const gb)
+{
+	sync_ppu_worker(gb);
+	const PpuWorker* const worker = gb->ppu.worker;
+	return worker != nullptr ? worker->ppu.screen : gb->ppu.screen;
+}
+
+
+void queue_ppu_line(const Memory& mem, Ppu* const ppu)
+{
+	PpuWorker* const worker = ppu->worker;
+	if (worker->snapshot < 0 || has_video_changes(mem, *ppu))
+		take_snapshot(mem, ppu);
+
+	PpuJob* const job = acquire_job(worker);
+	job->type = PpuJobType::Line;
+	job->ly = ppu->ly;
+	job->snapshot = static_cast<uint8_t>(worker->snapshot);
+	job->regs = get_line_registers(*ppu);
+	job->log = ppu->line_log;
+	push_job(worker);
+	if (worker->job_head - worker->job_published >= kPpuJobBatch)
+		publish_jobs(worker);
+
+	ppu->line_log.count = 0;
+}
+
+
+void queue_ppu_frame(const Sinks& sinks, Ppu* const ppu)
+{
+	PpuWorker* const worker = ppu->worker;
+	PpuJob* const job = acquire_job(worker);
+	job->type = PpuJobType::Frame;
+	job->sinks = sinks;
+	push_job(worker);
+	publish_jobs(worker);
+}
+
+
+// a snapshot is held until the worker gets to a line using the next one
+void* run_ppu_worker(void* const arg)
+{
+	PpuWorker* const worker = static_cast<PpuWorker*>(arg);
+	Ppu* const ppu = &worker->ppu;
+	int current = -1;
+
+	for (;;) {
+		wait_semaphore(&worker->jobs_filled);
+		const PpuJob& job = worker->jobs[worker->job_tail++ % kPpuJobCount];
+
+		switch (job.type) {
+		case PpuJobType::Line:
+			if (job.snapshot != current) {
+				if (current >= 0)
+					sem_post(&worker->snapshots_free);
+				current = job.snapshot;
+				apply_snapshot(worker->snapshots[current], ppu);
+			}
+			set_line_registers(job.regs, ppu);
+			ppu->ly = job.ly;
+			ppu->line_log = job.log;
+			draw_scanline(worker->snapshots[current].mem, ppu);
+			break;
+		case PpuJobType::Frame:
+			if (job.sinks.frame != nullptr)
+				job.sinks.frame(ppu->screen, job.sinks.userdata);
+			break;
+		case PpuJobType::Sync:
+			sem_post(&worker->synced);
+			break;
+		case PpuJobType::Quit:
+			return nullptr;
+		}
+
+		sem_post(&worker->jobs_free);
+	}
+}
+
+
+// the ppu's caches aren't used while the worker draws, so their dirty
+// marks tell what vram changed since the last snapshot. map writes
+// mark a map's caches in both addressing modes alike, the first one's
+// stand for both. oam writes only mark the sprite lists for the bytes
+// moving sprites
+bool has_video_changes(const Memory& mem, const Ppu& ppu)
+{
+	uint64_t dirty = 0;
+	for (const auto word : ppu.tiles.dirty)
+		dirty |= word;
+	for (const auto& modes : ppu.maps) {
+		for (const auto word : modes[0].dirty)
+			dirty |= word;
+	}
+
+	const Memory& last = ppu.worker->snapshots[ppu.worker->snapshot].mem;
+	return dirty != 0 || ppu.sprites.dirty || memcmp(last.oam, mem.oam, sizeof(mem.oam)) != 0;
+}
+
+
+// the worker frees the slots as it gets to the lines queued
+// since, which have to be published for it to get to them
+void take_snapshot(const Memory& mem, Ppu* const ppu)
+{
+	PpuWorker* const worker = ppu->worker;
+	publish_jobs(worker);
+	wait_semaphore(&worker->snapshots_free);
+	const int index = worker->snapshot_head++ % kPpuSnapshotCount;
+	PpuSnapshot& snapshot = worker->snapshots[index];
+
+	memcpy(snapshot.mem.vram, mem.vram, sizeof(mem.vram));
+	memcpy(snapshot.mem.oam, mem.oam, sizeof(mem.oam));
+	if (worker->snapshot < 0) {
+		memset(snapshot.tiles_dirty, 0xFF, sizeof(snapshot.tiles_dirty));
+		memset(snapshot.maps_dirty, 0xFF, sizeof(snapshot.maps_dirty));
+		snapshot.sprites_dirty = true;
+	} else {
+		memcpy(snapshot.tiles_dirty, ppu->tiles.dirty, sizeof(snapshot.tiles_dirty));
+		for (int i = 0; i < 2; ++i)
+			memcpy(snapshot.maps_dirty[i], ppu->maps[i][0].dirty, sizeof(snapshot.maps_dirty[i]));
+		snapshot.sprites_dirty = ppu->sprites.dirty;
+	}
+
+	memset(ppu->tiles.dirty, 0, sizeof(ppu->tiles.dirty));
+	for (auto& modes : ppu->maps) {
+		for (auto& map : modes)
+			memset(map.dirty, 0, sizeof(map.dirty));
+	}
+	ppu->sprites.dirty = false;
+	worker->snapshot = index;
+}
+
+
+void apply_snapshot(const PpuSnapshot& snapshot, Ppu* const ppu)
+{
+	for (size_t i = 0; i < arr_size(ppu->tiles.dirty); ++i)
+		ppu->tiles.dirty[i] |= snapshot.tiles_dirty[i];
+
+	for (int m = 0; m < 2; ++m) {
+		for (auto& map : ppu->maps[m]) {
+			for (size_t i = 0; i < arr_size(map.dirty); ++i)
+				map.dirty[i] |= snapshot.maps_dirty[m][i];
+		}
+	}
+
+	ppu->sprites.dirty = ppu->sprites.dirty || snapshot.sprites_dirty;
+}
+
+
+void mark_caches_dirty(Ppu* const ppu)
+{
+	memset(ppu->tiles.dirty, 0xFF, sizeof(ppu->tiles.dirty));
+	for (auto& modes : ppu->maps) {
+		for (auto& map : modes)
+			memset(map.dirty, 0xFF, sizeof(map.dirty));
+	}
+	ppu->sprites.dirty = true;
+}
+
+
+PpuJob* acquire_job(PpuWorker* const worker)
+{
+	wait_semaphore(&worker->jobs_free);
+	return &worker->jobs[worker->job_head % kPpuJobCount];
+}
+
+
+void push_job(PpuWorker* const worker)
+{
+	++worker->job_head;
+}
+
+
+void publish_jobs(PpuWorker* const worker)
+{
+	for (; worker->job_published != worker->job_head; ++worker->job_published)
+		sem_post(&worker->jobs_filled);
+}
+
+
+void wait_semaphore(sem_t* const sem)
+{
+	while (sem_wait(sem) != 0)
+		continue;
+}
+
+
+
+} // namespace gbx
+
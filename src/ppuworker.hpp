@@ -0,0 +1,81 @@
+#ifndef GBX_PPUWORKER_HPP_
+#define GBX_PPUWORKER_HPP_
+#include <pthread.h>
+#include <semaphore.h>
+#include "common.hpp"
+#include "memory.hpp"
+#include "ppu.hpp"
+#include "sinks.hpp"
+
+namespace gbx {
+
+constexpr const int kPpuJobCount = 256;
+constexpr const int kPpuSnapshotCount = 16;
+constexpr const int kPpuJobBatch = 16;
+
+
+enum class PpuJobType : uint8_t {
+	Line,
+	Frame,
+	Sync,
+	Quit
+};
+
+// a Line job is what the worker needs to draw line 'ly': the registers
+// as its mode 3 ended, the writes logged during it and the snapshot of
+// vram and oam it saw. a Frame job hands the lines drawn to 'sinks'
+struct PpuJob {
+	PpuJobType type;
+	uint8_t ly;
+	uint8_t snapshot;
+	LineRegisters regs;
+	LineLog log;
+	Sinks sinks;
+};
+
+// vram and oam ( the only parts of 'mem' copied ) as lines saw them,
+// plus the dirty marks the writes since the previous snapshot left,
+// which the worker moves to its own caches as it gets to it
+struct PpuSnapshot {
+	Memory mem;
+	uint64_t tiles_dirty[kTileCount / 64];
+	uint64_t maps_dirty[2][kMapCells / 64];
+	bool sprites_dirty;
+};
+
+// the jobs and the snapshots are single producer ( the emulation
+// thread ) single consumer ( the worker ) rings, each side owns its
+// index. the semaphores count the filled and free slots, they only
+// enter the kernel when a side has to wait for the other. lines are
+// published in batches, up to 'job_published', so the worker isn't
+// woken up for each one. it draws with its own 'ppu', whose caches
+// follow the snapshots
+struct PpuWorker {
+	pthread_t thread;
+	sem_t jobs_filled;
+	sem_t jobs_free;
+	sem_t snapshots_free;
+	sem_t synced;
+	uint32_t job_head;
+	uint32_t job_published;
+	uint32_t job_tail;
+	uint32_t snapshot_head;
+	int snapshot;
+	PpuJob jobs[kPpuJobCount];
+	PpuSnapshot snapshots[kPpuSnapshotCount];
+	Ppu ppu;
+};
+
+
+// queues the line ending its mode 3, taking a new snapshot
+// if vram or oam changed since the last line queued
+extern void queue_ppu_line(const Memory& mem, Ppu* ppu);
+
+// queues the frame's hand over to 'sinks.frame', which
+// the worker calls from its thread once the lines are drawn
+extern void queue_ppu_frame(const Sinks& sinks, Ppu* ppu);
+
+
+} // namespace gbx
+#endif
+
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gameboy.hpp"
+#include "rewind.hpp"
+
+namespace gbx {
+
+static void make_room(uint32_t size, Rewind* rewind);
+static void drop_oldest(Rewind* rewind);
+static uint32_t encode_state(const uint8_t* state, const uint8_t* base,
+                             uint32_t size, uint8_t* dest);
+static bool decode_state(const uint8_t* src, uint32_t src_size, const uint8_t* base,
+                         uint32_t size, uint8_t* dest);
+inline bool is_unchanged_run(const uint8_t* state, const uint8_t* base, uint32_t pos, uint32_t size);
+inline uint64_t load64(const uint8_t* src);
+
+
+Rewind* create_rewind(const uint32_t frames, const uint32_t bytes, const Gameboy& gb)
+{
+	Rewind* const rewind = static_cast<Rewind*>(calloc(1, sizeof(Rewind)));
+	if (rewind == nullptr) {
+		perror("Couldn't allocate memory");
+		return nullptr;
+	}
+
+	auto rewind_guard = finally([rewind] {
+		destroy_rewind(rewind);
+	});
+
+	// an entry's encoding is at most twice the state, plus a run header
+	const uint32_t state_size = static_cast<uint32_t>(get_state_size(gb));
+	rewind->max_entries = frames;
+	rewind->data_size = bytes;
+	rewind->state_size = state_size;
+	rewind->entries = static_cast<RewindEntry*>(malloc(sizeof(RewindEntry) * frames));
+	rewind->data = static_cast<uint8_t*>(malloc(bytes));
+	rewind->keyframe = static_cast<uint8_t*>(malloc(state_size));
+	rewind->zeros = static_cast<uint8_t*>(calloc(1, state_size));
+	rewind->state = static_cast<uint8_t*>(malloc(state_size));
+	rewind->encoded = static_cast<uint8_t*>(malloc(state_size * 2 + 4));
+
+	if (frames == 0 || rewind->entries == nullptr || rewind->data == nullptr ||
+	    rewind->keyframe == nullptr || rewind->zeros == nullptr ||
+	    rewind->state == nullptr || rewind->encoded == nullptr) {
+		perror("Couldn't allocate memory");
+		return nullptr;
+	}
+
+	rewind_guard.abort();
+	return rewind;
+}
+
+
+void destroy_rewind(Rewind* const rewind)
+{
+	free(rewind->entries);
+	free(rewind->data);
+	free(rewind->keyframe);
+	free(rewind->zeros);
+	free(rewind->state);
+	free(rewind->encoded);
+	free(rewind);
+}
+
+
+// a delta whose keyframe was dropped to make room for
+// it is thrown away and the state stored as a keyframe
+void capture_rewind(Gameboy* const gb, Rewind* const rewind)
+{
+	save_state(gb, rewind->state);
+
+	const uint32_t seq = rewind->first + rewind->count;
+	const uint32_t keyframe = rewind->count > 0
+	  ? rewind->entries[(seq - 1) % rewind->max_entries].keyframe : seq;
+	bool is_keyframe = rewind->count == 0 || seq - keyframe >= kRewindKeyframeInterval;
+
+	uint32_t size;
+	for (;;) {
+		const uint8_t* const base = is_keyframe ? rewind->zeros : rewind->keyframe;
+		size = encode_state(rewind->state, base, rewind->state_size, rewind->encoded);
+		if (size > rewind->data_size)
+			return;
+
+		make_room(size, rewind);
+		if (is_keyframe || (rewind->count > 0 && keyframe >= rewind->first))
+			break;
+		is_keyframe = true;
+	}
+
+	RewindEntry& entry = rewind->entries[seq % rewind->max_entries];
+	entry.offset = rewind->head;
+	entry.size = size;
+	entry.keyframe = is_keyframe ? seq : keyframe;
+	memcpy(&rewind->data[rewind->head], rewind->encoded, size);
+	rewind->head += size;
+	++rewind->count;
+
+	if (is_keyframe)
+		memcpy(rewind->keyframe, rewind->state, rewind->state_size);
+}
+
+
+// the space of the entry loaded is reused by the next capture. once a
+// keyframe is gone, the one of the newest entry left is decoded again.
+// an entry that doesn't decode drops all of them, the deltas left
+// can't be trusted either
+bool rewind_frame(Gameboy* const gb, Rewind* const rewind)
+{
+	if (rewind->count == 0)
+		return false;
+
+	const uint32_t seq = rewind->first + rewind->count - 1;
+	const RewindEntry& entry = rewind->entries[seq % rewind->max_entries];
+	const bool is_keyframe = entry.keyframe == seq;
+	if (!decode_state(&rewind->data[entry.offset], entry.size,
+	                  is_keyframe ? rewind->zeros : rewind->keyframe,
+	                  rewind->state_size, rewind->state)) {
+		rewind->count = 0;
+		return false;
+	}
+
+	rewind->head = entry.offset;
+	--rewind->count;
+
+	if (is_keyframe && rewind->count > 0) {
+		const RewindEntry& newest = rewind->entries[(seq - 1) % rewind->max_entries];
+		const RewindEntry& key = rewind->entries[newest.keyframe % rewind->max_entries];
+		if (!decode_state(&rewind->data[key.offset], key.size, rewind->zeros,
+		                  rewind->state_size, rewind->keyframe))
+			rewind->count = 0;
+	}
+
+	return load_state(rewind->state, rewind->state_size, gb);
+}
+
+
+// entries are laid out in capture order: the oldest ones from the
+// head on, up to where 'data' last wrapped around, then the newest
+// ones from its start up to the head. wrapping around again drops the
+// ones past the head, so the oldest entry left is the lowest one, and
+// the new entry's space is free once it doesn't overlap that one
+void make_room(const uint32_t size, Rewind* const rewind)
+{
+	if (rewind->head + size > rewind->data_size) {
+		while (rewind->count > 0 &&
+		       rewind->entries[rewind->first % rewind->max_entries].offset >= rewind->head)
+			drop_oldest(rewind);
+		rewind->head = 0;
+	}
+
+	const uint32_t begin = rewind->head;
+	const uint32_t end = begin + size;
+	while (rewind->count > 0) {
+		const RewindEntry& oldest = rewind->entries[rewind->first % rewind->max_entries];
+		const bool overlaps = oldest.offset < end && begin < oldest.offset + oldest.size;
+		if (!overlaps && rewind->count < rewind->max_entries)
+			break;
+		drop_oldest(rewind);
+	}
+}
+
+
+// drops the oldest keyframe along with the deltas depending on it
+void drop_oldest(Rewind* const rewind)
+{
+	do {
+		++rewind->first;
+		--rewind->count;
+	} while (rewind->count > 0 &&
+	         rewind->entries[rewind->first % rewind->max_entries].keyframe != rewind->first);
+}
+
+
+// runs of 16 bits counts: unchanged bytes, then literal bytes holding
+// the state xored with 'base'. literal runs end at 4 unchanged bytes,
+// fewer cost less as literals than as a new run
+uint32_t encode_state(const uint8_t* const state, const uint8_t* const base,
+                      const uint32_t size, uint8_t* const dest)
+{
+	uint8_t* out = dest;
+	uint32_t pos = 0;
+	while (pos < size) {
+		uint32_t unchanged = 0;
+		while (pos < size && unchanged < 0xFFFF) {
+			if (pos + 8 <= size && unchanged + 8 <= 0xFFFF &&
+			    load64(&state[pos]) == load64(&base[pos])) {
+				pos += 8;
+				unchanged += 8;
+			} else if (state[pos] == base[pos]) {
+				++pos;
+				++unchanged;
+			} else {
+				break;
+			}
+		}
+
+		uint8_t* const header = out;
+		out += 4;
+		uint32_t literals = 0;
+		while (pos < size && literals < 0xFFFF && !is_unchanged_run(state, base, pos, size)) {
+			*out++ = state[pos] ^ base[pos];
+			++pos;
+			++literals;
+		}
+
+		const uint16_t counts[2] { static_cast<uint16_t>(unchanged), static_cast<uint16_t>(literals) };
+		memcpy(header, counts, sizeof(counts));
+	}
+
+	return static_cast<uint32_t>(out - dest);
+}
+
+
+// returns false if the runs go past the state or past 'src_size'
+bool decode_state(const uint8_t* src, const uint32_t src_size, const uint8_t* const base,
+                  const uint32_t size, uint8_t* const dest)
+{
+	memcpy(dest, base, size);
+
+	const uint8_t* const src_end = src + src_size;
+	uint32_t pos = 0;
+	while (src < src_end) {
+		uint16_t counts[2];
+		if (src_end - src < static_cast<ptrdiff_t>(sizeof(counts)))
+			return false;
+
+		memcpy(counts, src, sizeof(counts));
+		src += sizeof(counts);
+		if (counts[0] > size - pos || counts[1] > size - pos - counts[0] ||
+		    counts[1] > src_end - src)
+			return false;
+
+		pos += counts[0];
+		for (int i = 0; i < counts[1]; ++i)
+			dest[pos++] ^= *src++;
+	}
+
+	return true;
+}
+
+
+bool is_unchanged_run(const uint8_t* const state, const uint8_t* const base,
+                      const uint32_t pos, const uint32_t size)
+{
+	const uint32_t end = min(pos + 4, size);
+	for (uint32_t i = pos; i < end; ++i) {
+		if (state[i] != base[i])
+			return false;
+	}
+	return true;
+}
+
+
+uint64_t load64(const uint8_t* const src)
+{
+	uint64_t value;
+	memcpy(&value, src, sizeof(value));
+	return value;
+}
+
+
+
+} // namespace gbx
+
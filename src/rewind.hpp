@@ -0,0 +1,60 @@
+#ifndef GBX_REWIND_HPP_
+#define GBX_REWIND_HPP_
+#include "common.hpp"
+
+namespace gbx {
+
+struct Gameboy;
+
+constexpr const uint32_t kRewindKeyframeInterval = 30;
+// a second of deltas against keyframes this far apart fits
+// in this much for most games, whose frames change little
+constexpr const uint32_t kRewindBytesPerSecond = 1_Mib;
+
+
+// a captured state: 'size' encoded bytes at 'offset' of the data ring.
+// keyframes have 'keyframe' set to their own sequence number
+struct RewindEntry {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t keyframe;
+};
+
+// the last states captured, one per frame. each is saved, xored with
+// the keyframe it depends on ( zeros for keyframes ) and stored as runs
+// of unchanged bytes and literal bytes. entries are numbered in capture
+// order, the ones held are 'first' to 'first + count - 1'. they are laid
+// out in 'data' in that order too, wrapping around to its start, the
+// oldest keyframe and its deltas are dropped to make room for new ones.
+// 'keyframe' holds the state of the newest entry's keyframe
+struct Rewind {
+	RewindEntry* entries;
+	uint8_t* data;
+	uint8_t* keyframe;
+	uint8_t* zeros;
+	uint8_t* state;
+	uint8_t* encoded;
+	uint32_t max_entries;
+	uint32_t data_size;
+	uint32_t state_size;
+	uint32_t first;
+	uint32_t count;
+	uint32_t head;
+};
+
+
+// holds up to 'frames' states of 'gb' in 'bytes' of encoded data
+extern Rewind* create_rewind(uint32_t frames, uint32_t bytes, const Gameboy& gb);
+extern void destroy_rewind(Rewind* rewind);
+
+// captures the state 'gb' is in, called once per frame
+extern void capture_rewind(Gameboy* gb, Rewind* rewind);
+
+// loads the newest state captured and drops it, so each call goes
+// a frame further back. returns false once there's none left
+extern bool rewind_frame(Gameboy* gb, Rewind* rewind);
+
+
+} // namespace gbx
+#endif
+
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "gameboy.hpp"
+#include "runahead.hpp"
+
+namespace gbx {
+
+static bool take_render_turn(RenderPolicy* policy, uint8_t* render_count);
+
+
+RunAhead* create_run_ahead(const uint8_t frames, const Gameboy& gb)
+{
+	RunAhead* const ahead = static_cast<RunAhead*>(malloc(sizeof(RunAhead)));
+	if (ahead == nullptr) {
+		perror("Couldn't allocate memory");
+		return nullptr;
+	}
+
+	ahead->state_size = static_cast<uint32_t>(get_state_size(gb));
+	ahead->state = static_cast<uint8_t*>(malloc(ahead->state_size));
+	ahead->frames = frames;
+	if (ahead->state == nullptr) {
+		perror("Couldn't allocate memory");
+		free(ahead);
+		return nullptr;
+	}
+
+	return ahead;
+}
+
+
+void destroy_run_ahead(RunAhead* const ahead)
+{
+	free(ahead->state);
+	free(ahead);
+}
+
+
+// each run holds the end of a ppu frame and the start of the next, so
+// the frame handed over is the one starting in the run before the last.
+// NextFrame draws that one alone, every other frame is skipped. the
+// caller's render policy picks the calls handing a frame over, one per
+// call like it would pick one per frame, and is back in place after
+void run_ahead_for(const int32_t clock_limit, RunAhead* const ahead, Gameboy* const gb)
+{
+	const int frames = ahead->frames;
+	if (frames == 0) {
+		run_for(clock_limit, gb);
+		return;
+	}
+
+	Ppu* const ppu = &gb->ppu;
+	RenderPolicy policy = ppu->render;
+	uint8_t render_count = ppu->render_count;
+	const bool draw = take_render_turn(&policy, &render_count);
+
+	const Sinks sinks = gb->sinks;
+	const auto set_render = [ppu, frames, draw](const int run) {
+		if (draw && run == frames - 1)
+			set_render_policy({ RenderMode::NextFrame, 0 }, ppu);
+		else if (run == 0 || (draw && run != frames))
+			set_render_policy({ RenderMode::Never, 0 }, ppu);
+	};
+
+	set_render(0);
+	run_for(clock_limit, gb);
+	save_state(gb, ahead->state);
+
+	gb->sinks.audio = nullptr;
+	for (int run = 1; run <= frames; ++run) {
+		set_render(run);
+		run_for(clock_limit, gb);
+	}
+
+	gb->sinks = sinks;
+	load_state(ahead->state, ahead->state_size, gb);
+	ppu->render = policy;
+	ppu->render_count = render_count;
+}
+
+
+// whether 'policy' draws the next frame, moving it on past that frame
+bool take_render_turn(RenderPolicy* const policy, uint8_t* const render_count)
+{
+	switch (policy->mode) {
+	case RenderMode::Always:
+		return true;
+	case RenderMode::NextFrame:
+		policy->mode = RenderMode::Never;
+		return true;
+	case RenderMode::EveryNth: {
+		const bool draw = *render_count == 0;
+		if (++*render_count >= policy->interval)
+			*render_count = 0;
+		return draw;
+	}
+	case RenderMode::Never:
+		return false;
+	}
+
+	return false;
+}
+
+
+} // namespace gbx
@@ -0,0 +1,33 @@
+#ifndef GBX_RUNAHEAD_HPP_
+#define GBX_RUNAHEAD_HPP_
+#include "common.hpp"
+
+namespace gbx {
+
+struct Gameboy;
+
+
+// the state the speculative frames start from, 'frames' is how
+// many are run past each real one, 0 runs the real ones alone
+struct RunAhead {
+	uint8_t* state;
+	uint32_t state_size;
+	uint8_t frames;
+};
+
+
+extern RunAhead* create_run_ahead(uint8_t frames, const Gameboy& gb);
+extern void destroy_run_ahead(RunAhead* ahead);
+
+// runs a frame of 'clock_limit' cycles like run_for, then the next
+// 'ahead->frames' frames with the same input and goes back to the end
+// of the first one. the frame sink gets the frame drawn last and the
+// audio sink the first frame's samples alone. the ppu's render policy
+// is set for the frames run so only the frame handed over is drawn, the
+// caller's policy decides which calls hand one over
+extern void run_ahead_for(int32_t clock_limit, RunAhead* ahead, Gameboy* gb);
+
+
+} // namespace gbx
+#endif
+
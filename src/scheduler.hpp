@@ -0,0 +1,56 @@
+#ifndef GBX_SCHEDULER_HPP_
+#define GBX_SCHEDULER_HPP_
+#include "common.hpp"
+
+namespace gbx {
+
+// hardware brought up to date by the scheduler, one deadline slot each
+enum class Event : uint8_t {
+	Ppu,
+	Timers,
+	Apu,
+	Count
+};
+
+constexpr const int kEventCount = static_cast<int>(Event::Count);
+
+
+// 'deadlines' are the cpu clocks of each peripheral's next visible
+// state change ( ppu mode change, DIV / TIMA increment, apu frame
+// sequencer step ), 'synced' the clock each one was last brought up to.
+// the cpu runs freely until 'next', the earliest of the deadlines
+struct Scheduler {
+	int32_t deadlines[kEventCount];
+	int32_t synced[kEventCount];
+	int32_t next;
+};
+
+
+inline void set_deadline(const Event event, const int32_t deadline, Scheduler* const sched)
+{
+	sched->deadlines[static_cast<int>(event)] = deadline;
+
+	int32_t next = sched->deadlines[0];
+	for (int i = 1; i < kEventCount; ++i)
+		next = min(next, sched->deadlines[i]);
+
+	sched->next = next;
+}
+
+
+// moves every timestamp by 'cycles', used when the cpu clock
+// is rebased or advances without the hardware seeing it
+inline void shift_events(const int32_t cycles, Scheduler* const sched)
+{
+	for (int i = 0; i < kEventCount; ++i) {
+		sched->deadlines[i] += cycles;
+		sched->synced[i] += cycles;
+	}
+
+	sched->next += cycles;
+}
+
+
+} // namespace gbx
+#endif
+
@@ -0,0 +1,23 @@
+#ifndef GBX_SINKS_HPP_
+#define GBX_SINKS_HPP_
+#include "common.hpp"
+#include "frame.hpp"
+
+namespace gbx {
+
+// where the core hands its output to the frontend, both are called
+// from inside run_for, but 'frame' is called from the ppu worker's
+// thread while set_ppu_async is on. 'frame' gets the indexed screen once the ppu
+// wraps back to line 0, see convert_frame for turning it into colors.
+// 'audio' gets the 44100hz mono samples of each video frame. either
+// can be left null to discard that output
+struct Sinks {
+	void (*frame)(const Frame& frame, void* userdata);
+	void (*audio)(const int16_t* samples, int32_t count, void* userdata);
+	void* userdata;
+};
+
+
+} // namespace gbx
+#endif
+
@@ -0,0 +1,213 @@
+#include <string.h>
+#include "gameboy.hpp"
+#include "state.hpp"
+
+namespace gbx {
+
+// the same field list sizes, saves and loads a state,
+// 'Io' is called with each field's bytes in order
+template<class Io>
+static void transfer_state(Io& io, Gameboy* gb);
+template<class Io, class T>
+static void transfer_field(Io& io, T& field);
+static void mark_vram_changes(const uint8_t* old_vram, const Memory& mem, Ppu* ppu);
+static bool has_code_changes(const uint8_t* old_wram, const uint8_t* old_hram, const Gameboy& gb);
+static uint16_t get_rom_checksum(const Cart& cart);
+
+
+struct StateSizer {
+	void operator()(void*, const size_t size) { total += size; }
+	size_t total;
+};
+
+struct StateWriter {
+	void operator()(const void* const field, const size_t size)
+	{
+		memcpy(pos, field, size);
+		pos += size;
+	}
+	uint8_t* pos;
+};
+
+struct StateReader {
+	void operator()(void* const field, const size_t size)
+	{
+		memcpy(field, pos, size);
+		pos += size;
+	}
+	const uint8_t* pos;
+};
+
+
+size_t get_state_size(const Gameboy& gb)
+{
+	// the sizer only looks at the fields' sizes
+	StateSizer sizer { sizeof(StateHeader) };
+	transfer_state(sizer, const_cast<Gameboy*>(&gb));
+	return sizer.total;
+}
+
+
+void save_state(Gameboy* const gb, void* const dest)
+{
+	sync_ppu_worker(gb);
+
+	StateHeader header {};
+	memcpy(header.magic, "GBXS", 4);
+	header.version = kStateVersion;
+	header.size = static_cast<uint32_t>(get_state_size(*gb));
+	header.rom_checksum = get_rom_checksum(gb->cart);
+
+	StateWriter writer { static_cast<uint8_t*>(dest) };
+	writer(&header, sizeof(header));
+	transfer_state(writer, gb);
+}
+
+
+// the ppu's caches aren't part of the state, the entries drawn from
+// vram the state changes are marked dirty instead, likewise the sprite
+// lists and the blocks cached from ram are only dropped if what they
+// came from changed. the ppu keeps the accuracy it had, finishing the
+// loaded mode 3 with it
+bool load_state(const void* const src, const size_t size, Gameboy* const gb)
+{
+	StateHeader header {};
+	if (size < sizeof(header))
+		return false;
+
+	memcpy(&header, src, sizeof(header));
+	if (memcmp(header.magic, "GBXS", 4) != 0 || header.version != kStateVersion ||
+	    header.size != size || size != get_state_size(*gb) ||
+	    header.rom_checksum != get_rom_checksum(gb->cart))
+		return false;
+
+	sync_ppu_worker(gb);
+
+	Ppu* const ppu = &gb->ppu;
+	Memory* const mem = &gb->memory;
+	const PpuAccuracy accuracy = ppu->accuracy;
+	const uint8_t old_obj_size = ppu->lcdc.obj_size;
+	uint8_t old_vram[sizeof(mem->vram)];
+	uint8_t old_oam[sizeof(mem->oam)];
+	uint8_t old_wram[sizeof(mem->wram)];
+	uint8_t old_hram[sizeof(mem->hram)];
+	memcpy(old_vram, mem->vram, sizeof(old_vram));
+	memcpy(old_oam, mem->oam, sizeof(old_oam));
+	for (int page = 0; page < 2; ++page) {
+		const int begin = page << kPageShift;
+		if (gb->blkcache.code_pages & (1 << page))
+			memcpy(&old_wram[begin], &mem->wram[begin], 4_Kib);
+	}
+	memcpy(old_hram, mem->hram, sizeof(old_hram));
+
+	StateReader reader { static_cast<const uint8_t*>(src) + sizeof(header) };
+	transfer_state(reader, gb);
+
+	mark_vram_changes(old_vram, *mem, ppu);
+	if (ppu->lcdc.obj_size != old_obj_size || memcmp(old_oam, mem->oam, sizeof(old_oam)) != 0)
+		ppu->sprites.dirty = true;
+	update_page_table(gb);
+	if (has_code_changes(old_wram, old_hram, *gb))
+		invalidate_ram_blocks(gb);
+	set_ppu_accuracy(accuracy, gb);
+	return true;
+}
+
+
+template<class Io>
+void transfer_state(Io& io, Gameboy* const gb)
+{
+	transfer_field(io, gb->cpu);
+	transfer_field(io, gb->hwstate);
+	transfer_field(io, gb->joypad);
+	transfer_field(io, gb->sched);
+
+	Ppu& ppu = gb->ppu;
+	transfer_field(io, ppu.clock);
+	transfer_field(io, ppu.lcdc);
+	transfer_field(io, ppu.stat);
+	transfer_field(io, ppu.scy);
+	transfer_field(io, ppu.scx);
+	transfer_field(io, ppu.wy);
+	transfer_field(io, ppu.wx);
+	transfer_field(io, ppu.ly);
+	transfer_field(io, ppu.lyc);
+	transfer_field(io, ppu.bgp);
+	transfer_field(io, ppu.obp0);
+	transfer_field(io, ppu.obp1);
+	transfer_field(io, ppu.line_log);
+	transfer_field(io, ppu.accuracy);
+	transfer_field(io, ppu.fifo);
+	// the worker draws the frame while it runs
+	transfer_field(io, ppu.worker != nullptr ? ppu.worker->ppu.screen : ppu.screen);
+
+	transfer_field(io, gb->apu);
+	transfer_field(io, gb->memory);
+
+	Cart& cart = gb->cart;
+	transfer_field(io, cart.mbc1);
+	transfer_field(io, cart.rom_bank_offset);
+	transfer_field(io, cart.ram_bank_offset);
+	io(&cart.data[cart.info.rom_size()], cart.info.ram_size());
+}
+
+
+template<class Io, class T>
+void transfer_field(Io& io, T& field)
+{
+	io(&field, sizeof(field));
+}
+
+
+// tiles are compared whole, map cells byte by byte
+void mark_vram_changes(const uint8_t* const old_vram, const Memory& mem, Ppu* const ppu)
+{
+	int offset = 0;
+	for (; offset < kTileCount * 16; offset += 16) {
+		if (memcmp(&old_vram[offset], &mem.vram[offset], 16) != 0)
+			mark_vram_dirty(offset, ppu);
+	}
+
+	for (; offset < static_cast<int>(sizeof(mem.vram)); ++offset) {
+		if (old_vram[offset] != mem.vram[offset])
+			mark_vram_dirty(offset, ppu);
+	}
+}
+
+
+// whether a byte of wram or hram a cached block was decoded from
+// changed. only the wram pages with marks were saved in 'old_wram'.
+// marks are 0 or 1, the loops are kept free of branches to vectorize
+bool has_code_changes(const uint8_t* const old_wram, const uint8_t* const old_hram, const Gameboy& gb)
+{
+	const BlockCache& cache = gb.blkcache;
+	const Memory& mem = gb.memory;
+	uint8_t changes = 0;
+	for (int page = 0; page < 2; ++page) {
+		const int begin = page << kPageShift;
+		if (!(cache.code_pages & (1 << page)) ||
+		    memcmp(&old_wram[begin], &mem.wram[begin], 4_Kib) == 0)
+			continue;
+
+		for (int i = begin; i < begin + static_cast<int>(4_Kib); ++i)
+			changes |= (old_wram[i] ^ mem.wram[i]) & -cache.code_marks[i];
+	}
+
+	const uint8_t* const hram_marks = &cache.code_marks[kBlockHramMarksOffset];
+	for (size_t i = 0; i < sizeof(mem.hram); ++i)
+		changes |= (old_hram[i] ^ mem.hram[i]) & -hram_marks[i];
+
+	return changes != 0;
+}
+
+
+// the global checksum in the cart header
+uint16_t get_rom_checksum(const Cart& cart)
+{
+	return concat_bytes(cart.data[0x14E], cart.data[0x14F]);
+}
+
+
+
+} // namespace gbx
+
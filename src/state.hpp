@@ -0,0 +1,39 @@
+#ifndef GBX_STATE_HPP_
+#define GBX_STATE_HPP_
+#include "common.hpp"
+
+namespace gbx {
+
+struct Gameboy;
+
+constexpr const uint32_t kStateVersion = 1;
+
+
+// a save state starts with this header, the rest is the emulated state
+// as this build lays its structs out: Cpu, HWState, Joypad, Scheduler,
+// the ppu's registers and the frame being drawn, Apu, Memory, the cart's
+// bank registers and its RAM. the rom isn't part of it, 'rom_checksum'
+// ties the state to the cart it was saved from. the version is bumped
+// whenever one of those structs changes
+struct StateHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t size;
+	uint16_t rom_checksum;
+};
+
+
+// the bytes save_state writes, the same for every state of 'gb'
+extern size_t get_state_size(const Gameboy& gb);
+
+// writes get_state_size(*gb) bytes to 'dest', syncing the ppu worker
+extern void save_state(Gameboy* gb, void* dest);
+
+// returns false if 'src' isn't a state saved
+// by this build from the cart 'gb' is running
+extern bool load_state(const void* src, size_t size, Gameboy* gb);
+
+
+} // namespace gbx
+#endif
+